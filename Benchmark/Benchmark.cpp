@@ -0,0 +1,1010 @@
+#include "../gif_animation/gif_animation.h"
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <functional>
+#include <thread>
+#include <tuple>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <memory_resource>
+#include <sstream>
+#include <cmath>
+
+//Every heap allocation in the process is counted, for the steady state numbers.
+//All the replaceable forms go through here so array and over-aligned allocations count as well.
+static std::atomic<size_t> allocations = 0;
+
+static void* allocate(std::size_t size) {
+	allocations++;
+	if (auto* p = std::malloc(size != 0 ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+static void* allocate(std::size_t size, std::align_val_t alignment) {
+	allocations++;
+	auto const align = std::max(std::size_t(alignment), sizeof(void*));
+	size = (std::max(size, std::size_t(1)) + align - 1) / align * align;
+#ifdef _MSC_VER
+	if (auto* p = _aligned_malloc(size, align))
+		return p;
+#else
+	if (auto* p = std::aligned_alloc(align, size))
+		return p;
+#endif
+	throw std::bad_alloc();
+}
+
+static void release(void* p) noexcept {
+	std::free(p);
+}
+
+static void releaseAligned(void* p) noexcept {
+#ifdef _MSC_VER
+	_aligned_free(p);
+#else
+	std::free(p);
+#endif
+}
+
+void* operator new(std::size_t size) {
+	return allocate(size);
+}
+
+void* operator new[](std::size_t size) {
+	return allocate(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+	return allocate(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+	return allocate(size, alignment);
+}
+
+void operator delete(void* p) noexcept {
+	release(p);
+}
+
+void operator delete[](void* p) noexcept {
+	release(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+	release(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+	release(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+	releaseAligned(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+	releaseAligned(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+	releaseAligned(p);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept {
+	releaseAligned(p);
+}
+
+//Throughput numbers for the encoder stages, run a Release build for anything meaningful
+namespace bench {
+	using clock = std::chrono::steady_clock;
+
+	//Set from the command line, csv rows carry the suite so runs can be diffed against each other
+	bool csv = false;
+	std::string suite;
+
+	//Best of a few runs in milliseconds, the first run also warms the caches
+	auto time(std::function<void()> const& f, int runs = 3) -> double {
+		double best = 0;
+		for (int i = 0; i < runs; i++) {
+			auto const start = clock::now();
+			f();
+			auto const took = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+			if (i == 0 || took < best)
+				best = took;
+		}
+		return best;
+	}
+
+	void heading(std::string const& title) {
+		if (!csv)
+			std::cout << title << std::endl;
+	}
+
+	//Smooth diagonal bands, compresses well like most rendered content
+	auto gradientIndices(size_t width, size_t height, size_t colorTableBits) -> std::vector<byte> {
+		std::vector<byte> out(width * height);
+		auto const colors = size_t(1) << colorTableBits;
+		for (size_t y = 0; y < height; y++) {
+			for (size_t x = 0; x < width; x++) {
+				out[y * width + x] = byte(((x + y) / 8) % colors);
+			}
+		}
+		return out;
+	}
+
+	//Uniform noise, the worst case for the dictionary
+	auto noiseIndices(size_t width, size_t height, size_t colorTableBits) -> std::vector<byte> {
+		std::vector<byte> out(width * height);
+		std::mt19937 rng(42);
+		std::uniform_int_distribution<int> dist(0, (1 << colorTableBits) - 1);
+		for (auto& b : out) {
+			b = byte(dist(rng));
+		}
+		return out;
+	}
+
+	//Gradient on top and noise below, a table filled on the first half is useless for the second
+	auto splitIndices(size_t width, size_t height, size_t colorTableBits) -> std::vector<byte> {
+		auto out = gradientIndices(width, height, colorTableBits);
+		auto const noise = noiseIndices(width, height, colorTableBits);
+		std::copy(noise.begin() + (out.size() / 2), noise.end(), out.begin() + (out.size() / 2));
+		return out;
+	}
+
+	//Hue bands that move a little every frame, like the animations in the tests
+	auto rainbowFrames(size_t width, size_t height, size_t count) -> std::vector<std::vector<gif::RGBpixel>> {
+		std::vector<std::vector<gif::RGBpixel>> frames(count);
+		for (size_t f = 0; f < count; f++) {
+			frames[f].resize(width * height);
+			for (size_t y = 0; y < height; y++) {
+				for (size_t x = 0; x < width; x++) {
+					auto const hue = (x + y + f * 4) % 768;
+					auto const ramp = uint8_t(hue % 256);
+					auto& p = frames[f][y * width + x];
+					switch (hue / 256) {
+					case 0: p = gif::RGBpixel{ uint8_t(255 - ramp), ramp, 0 }; break;
+					case 1: p = gif::RGBpixel{ 0, uint8_t(255 - ramp), ramp }; break;
+					default: p = gif::RGBpixel{ ramp, 0, uint8_t(255 - ramp) }; break;
+					}
+				}
+			}
+		}
+		return frames;
+	}
+
+	//A still desktop with a cursor sliding over it, what screen recordings mostly look like
+	auto screenFrames(size_t width, size_t height, size_t count) -> std::vector<std::vector<gif::RGBpixel>> {
+		auto const desktop = rainbowFrames(width, height, 1)[0];
+		std::vector<std::vector<gif::RGBpixel>> frames(count, desktop);
+		for (size_t f = 0; f < count; f++) {
+			for (size_t y = 0; y < 16; y++) {
+				for (size_t x = 0; x < 16; x++) {
+					frames[f][(y + f * 3 % (height - 16)) * width + (x + f * 7) % width] = gif::RGBpixel{ 255, 255, 255 };
+				}
+			}
+		}
+		return frames;
+	}
+
+	//Gradient bands in full color, shifted a little every frame
+	auto gradientFrames(size_t width, size_t height, size_t count) -> std::vector<std::vector<gif::RGBpixel>> {
+		std::vector<std::vector<gif::RGBpixel>> frames(count);
+		for (size_t f = 0; f < count; f++) {
+			frames[f].resize(width * height);
+			for (size_t y = 0; y < height; y++) {
+				for (size_t x = 0; x < width; x++) {
+					frames[f][y * width + x] = gif::RGBpixel{ uint8_t(x + f), uint8_t(y), uint8_t((x + y) / 2) };
+				}
+			}
+		}
+		return frames;
+	}
+
+	//The gradient with a little sensor noise on top, where exact LZW matches break up the most
+	auto noisyGradientFrames(size_t width, size_t height, size_t count) -> std::vector<std::vector<gif::RGBpixel>> {
+		auto frames = gradientFrames(width, height, count);
+		std::mt19937 rng(7);
+		for (auto& frame : frames) {
+			for (auto& p : frame) {
+				auto const noise = int(rng() % 13) - 6;
+				p = gif::RGBpixel{ uint8_t(std::clamp(p.r + noise, 0, 255)), uint8_t(std::clamp(p.g + noise, 0, 255)), uint8_t(std::clamp(p.b + noise, 0, 255)) };
+			}
+		}
+		return frames;
+	}
+
+	//Every frame fresh noise, nothing survives quantization or carries over between frames
+	auto noiseFrames(size_t width, size_t height, size_t count) -> std::vector<std::vector<gif::RGBpixel>> {
+		std::vector<std::vector<gif::RGBpixel>> frames(count);
+		std::mt19937 rng(42);
+		for (auto& frame : frames) {
+			frame.resize(width * height);
+			for (auto& p : frame) {
+				auto const bits = rng();
+				p = gif::RGBpixel{ uint8_t(bits), uint8_t(bits >> 8), uint8_t(bits >> 16) };
+			}
+		}
+		return frames;
+	}
+
+	//pixelBytes is what one pixel of input weighs, 3 for RGB and 1 for indices, the ratio is input over output
+	void report(std::string const& name, size_t pixels, double ms, size_t bytes, size_t pixelBytes = 3) {
+		auto const seconds = ms / 1e3;
+		auto const input = double(pixels * pixelBytes);
+		auto const ratio = bytes != 0 ? input / double(bytes) : 0.0;
+		if (csv) {
+			std::cout << suite << ",\"" << name << "\"," << ms << "," << pixels << "," << double(pixels) / seconds << ","
+				<< input / seconds << "," << bytes << "," << ratio << std::endl;
+			return;
+		}
+		std::cout << std::left << std::setw(40) << name
+			<< std::right << std::setw(10) << std::fixed << std::setprecision(2) << ms << " ms"
+			<< std::setw(10) << std::setprecision(1) << (double(pixels) / 1e6) / seconds << " Mpx/s"
+			<< std::setw(10) << std::setprecision(1) << (input / 1e6) / seconds << " MB/s"
+			<< std::setw(12) << bytes << " bytes"
+			<< std::setw(9) << std::setprecision(2) << ratio << ":1" << std::endl;
+	}
+
+	//For kernels that only move bytes around, bytes is what they read plus what they wrote
+	void reportBandwidth(std::string const& name, size_t bytes, double ms) {
+		if (csv) {
+			std::cout << suite << ",\"" << name << "\"," << ms << ",,," << double(bytes) / (ms / 1e3) << ",," << std::endl;
+			return;
+		}
+		std::cout << std::left << std::setw(40) << name
+			<< std::right << std::setw(10) << std::fixed << std::setprecision(2) << ms << " ms"
+			<< std::setw(10) << std::setprecision(2) << (double(bytes) / 1e9) / (ms / 1e3) << " GB/s" << std::endl;
+	}
+
+	using generator = std::vector<std::vector<gif::RGBpixel>>(*)(size_t, size_t, size_t);
+
+	auto const inputs = {
+		std::pair{ std::string("gradient"), generator(&gradientFrames) },
+		std::pair{ std::string("noise"), generator(&noiseFrames) },
+		std::pair{ std::string("screen"), generator(&screenFrames) },
+		std::pair{ std::string("rainbow"), generator(&rainbowFrames) } };
+
+	//Each step of a single frame encode on its own, every step gets the output of the one before
+	void stages() {
+		heading("Encoder stages");
+		gif::encoder enc;
+
+		for (auto const& [width, height] : { std::pair{ 320, 240 }, std::pair{ 640, 480 }, std::pair{ 1920, 1080 } }) {
+			for (auto const& [pattern, generate] : inputs) {
+				auto const frame = generate(width, height, 1)[0];
+				auto const label = pattern + " " + std::to_string(width) + "x" + std::to_string(height);
+
+				std::vector<gif::RGBpixel> palette;
+				auto ms = time([&] {
+					palette = gif::palletize(frame);
+					});
+				report(label + " palletize", frame.size(), ms, palette.size() * 3);
+
+				size_t lower = 0;
+				ms = time([&] {
+					lower = gif::median_cut(frame).first.size();
+					});
+				report(label + " median_cut", frame.size(), ms, lower * 3);
+
+				auto table = gif::colorTable(palette);
+				std::vector<byte> indices;
+				ms = time([&] {
+					indices = gif::mapPixels(frame, table);
+					});
+				report(label + " mapPixels", frame.size(), ms, indices.size());
+
+				auto const bits = table.bitsNeeded();
+				gif::lzw_code codes;
+				ms = time([&] {
+					codes = enc.lzw_encode(indices, bits);
+					});
+				auto const count = std::visit([](auto const& v) { return v.size(); }, codes);
+				report(label + " lzw_encode", indices.size(), ms, count * 2, 1);
+
+				size_t packed = 0;
+				ms = time([&] {
+					packed = std::visit([](auto const& v) -> size_t {
+						return gif::pack(v).first.size();
+						}, codes);
+					});
+				report(label + " pack", indices.size(), ms, packed, 1);
+			}
+		}
+	}
+
+	//Whole files, the ratio is against the raw RGB of every frame
+	void fullEncode() {
+		heading("Full encode");
+		for (auto const& [width, height] : { std::pair{ 320, 240 }, std::pair{ 640, 480 }, std::pair{ 1280, 720 } }) {
+			for (size_t const count : { 1, 10, 30 }) {
+				for (auto const& [pattern, generate] : inputs) {
+					auto const frames = generate(width, height, count);
+					auto const pixels = frames.size() * frames[0].size();
+
+					size_t bytes = 0;
+					auto const ms = time([&] {
+						bytes = gif::encoder(uint16_t(width), uint16_t(height), frames).write().value().size();
+						}, 1);
+					report(pattern + " " + std::to_string(count) + "x" + std::to_string(width) + "x" + std::to_string(height), pixels, ms, bytes);
+				}
+			}
+		}
+	}
+
+	//Decoding files the encoder wrote, LZW into a buffer of indices on its own and drawn onto a canvas.
+	//The ratio is against the raw RGB of every frame, like for the encoder.
+	void decoding() {
+		heading("Decoding");
+		for (auto const& [width, height] : { std::pair{ 640, 480 }, std::pair{ 1920, 1080 } }) {
+			for (auto const& [pattern, generate] : inputs) {
+				auto const frames = generate(width, height, 10);
+				auto const file = gif::encoder(uint16_t(width), uint16_t(height), frames).write().value();
+				auto const pixels = frames.size() * frames[0].size();
+				auto const label = pattern + " 10x" + std::to_string(width) + "x" + std::to_string(height);
+
+				std::vector<byte> indices(frames[0].size());
+				auto ms = time([&] {
+					gif::decoder dec(file);
+					while (dec.next()) {
+						dec.decode(indices.data());
+					}
+					});
+				report(label + " indices", pixels, ms, file.size());
+
+				std::vector<gif::RGBpixel> canvas(frames[0].size());
+				ms = time([&] {
+					gif::decoder dec(file);
+					while (dec.next()) {
+						dec.composite(canvas.data());
+					}
+					});
+				report(label + " composited", pixels, ms, file.size());
+			}
+		}
+	}
+
+	//Rewriting files the encoder wrote with delta frames. A new loop count copies every frame, dropping every other
+	//frame only draws again what the dropped frames changed. Decoding every frame and encoding the result is what
+	//both would cost without the optimizer.
+	void optimizer() {
+		heading("Optimizer");
+		for (auto const& [width, height] : { std::pair{ 640, 480 }, std::pair{ 1920, 1080 } }) {
+			for (auto const& [pattern, generate] : inputs) {
+				auto const frames = generate(width, height, 10);
+				auto enc = gif::encoder(uint16_t(width), uint16_t(height), frames);
+				enc.setDeltaFrames(true);
+				auto const file = enc.write().value();
+				auto const pixels = frames.size() * frames[0].size();
+				auto const label = pattern + " 10x" + std::to_string(width) + "x" + std::to_string(height);
+
+				std::vector<byte> output;
+				auto ms = time([&] {
+					gif::optimizer opt(file);
+					opt.setLoops(std::nullopt);
+					opt.writeTo(output);
+					});
+				report(label + " loops", pixels, ms, output.size());
+
+				ms = time([&] {
+					gif::optimizer opt(file);
+					opt.cropFrame(5, gif::region{ 0, 0, uint16_t(width / 2), uint16_t(height / 2) });
+					opt.writeTo(output);
+					});
+				report(label + " crop one frame", pixels, ms, output.size());
+
+				ms = time([&] {
+					gif::optimizer opt(file);
+					opt.dropFrame(5);
+					opt.writeTo(output);
+					});
+				report(label + " drop one frame", pixels, ms, output.size());
+
+				ms = time([&] {
+					gif::optimizer opt(file);
+					for (size_t i = 1; i < opt.frameCount(); i += 2) {
+						opt.dropFrame(i);
+					}
+					opt.writeTo(output);
+					});
+				report(label + " drop half", pixels, ms, output.size());
+
+				ms = time([&] {
+					gif::decoder dec(file);
+					std::vector<std::vector<gif::RGBpixel>> shown;
+					std::vector<gif::RGBpixel> canvas(frames[0].size());
+					while (dec.next()) {
+						dec.composite(canvas.data());
+						shown.push_back(canvas);
+					}
+					auto again = gif::encoder(uint16_t(width), uint16_t(height), shown);
+					again.setDeltaFrames(true);
+					again.writeTo(output);
+					});
+				report(label + " decode+encode", pixels, ms, output.size());
+			}
+		}
+	}
+
+#if GIF_STATS
+	//Where the time of a whole file goes, summed over threads, only there when built with GIF_STATS
+	void stageBreakdown() {
+		heading("Stage breakdown");
+		std::string const names[] = { "analysis", "quantization", "mapping", "compression", "framing" };
+
+		for (auto const& [pattern, generate] : inputs) {
+			auto const frames = generate(640, 480, 10);
+			std::vector<gif::pixelView> views;
+			for (auto const& frame : frames) {
+				views.emplace_back(frame, 640, 480);
+			}
+			auto const pixels = frames.size() * frames[0].size();
+
+			gif::encodeStats stats;
+			auto enc = gif::encoder(640, 480, views);
+			enc.setStats(&stats);
+			enc.reset(640, 480, views);
+			auto const bytes = enc.write().value().size();
+			for (size_t stage = 0; stage < gif::encodeStats::stages; stage++) {
+				report(pattern + " 10x640x480 " + names[stage], pixels, stats.times[stage].wallMs, bytes);
+			}
+			report(pattern + " 10x640x480 elapsed", pixels, stats.elapsedMs, bytes);
+		}
+	}
+#endif
+
+	//lzw_encode + pack against the streaming lzw_compress
+	void lzwPacking() {
+		heading("LZW code packing");
+		gif::encoder enc;
+
+		for (size_t const side : { 500, 1000, 2000 }) {
+			for (auto const& [pattern, generate] : {
+				std::pair{ std::string("gradient"), &gradientIndices },
+				std::pair{ std::string("noise"), &noiseIndices } }) {
+				auto const in = generate(side, side, 8);
+				auto const label = pattern + " " + std::to_string(side) + "x" + std::to_string(side);
+
+				size_t packedBytes = 0;
+				auto const packMs = time([&] {
+					auto const codes = enc.lzw_encode(in, 8);
+					packedBytes = std::visit([](auto const& v) -> size_t {
+						return gif::pack(v).first.size();
+						}, codes);
+					});
+				report(label + " pack", in.size(), packMs, packedBytes, 1);
+
+				size_t streamedBytes = 0;
+				auto const streamMs = time([&] {
+					streamedBytes = enc.lzw_compress(in, 8).size();
+					});
+				report(label + " bitWriter", in.size(), streamMs, streamedBytes, 1);
+			}
+		}
+	}
+
+	//Size and speed of each way of dealing with a full dictionary
+	void dictionaryPolicies() {
+		heading("LZW dictionary policies");
+		gif::encoder enc;
+
+		for (auto const& [pattern, generate] : {
+			std::pair{ std::string("gradient"), &gradientIndices },
+			std::pair{ std::string("noise"), &noiseIndices },
+			std::pair{ std::string("split"), &splitIndices } }) {
+			auto const in = generate(1000, 1000, 8);
+
+			for (auto const& [name, policy] : {
+				std::pair{ std::string("clear"), gif::dictionaryPolicy::clear },
+				std::pair{ std::string("deferred"), gif::dictionaryPolicy::deferred },
+				std::pair{ std::string("adaptive"), gif::dictionaryPolicy::adaptive } }) {
+				size_t bytes = 0;
+				auto const ms = time([&] {
+					bytes = enc.lzw_compress(in, 8, policy).size();
+					});
+				report(pattern + " 1000x1000 " + name, in.size(), ms, bytes, 1);
+			}
+		}
+	}
+
+	//Size against time for each compression level, on index streams and on whole files
+	void compressionLevels() {
+		heading("LZW compression levels");
+		auto const levels = {
+			std::pair{ std::string("fast"), gif::compressionLevel::fast },
+			std::pair{ std::string("lookahead"), gif::compressionLevel::lookahead },
+			std::pair{ std::string("best"), gif::compressionLevel::best } };
+
+		for (auto const& [pattern, generate] : {
+			std::pair{ std::string("gradient"), &gradientIndices },
+			std::pair{ std::string("noise"), &noiseIndices },
+			std::pair{ std::string("split"), &splitIndices } }) {
+			auto const in = generate(1000, 1000, 8);
+			for (auto const& [name, level] : levels) {
+				gif::encoder enc;
+				enc.setCompressionLevel(level);
+				size_t bytes = 0;
+				auto const ms = time([&] {
+					bytes = enc.lzw_compress(in, 8).size();
+					});
+				report(pattern + " 1000x1000 " + name, in.size(), ms, bytes, 1);
+			}
+		}
+
+		for (auto const& [pattern, generate] : inputs) {
+			auto const frames = generate(640, 480, 10);
+			for (auto const& [name, level] : levels) {
+				auto enc = gif::encoder(640, 480, frames);
+				enc.setCompressionLevel(level);
+				size_t bytes = 0;
+				auto const ms = time([&] {
+					bytes = enc.write().value().size();
+					});
+				report(pattern + " 10x640x480 " + name, frames.size() * frames[0].size(), ms, bytes);
+			}
+		}
+	}
+
+	//Size against error for lossy LZW, the error is the PSNR of what a viewer shows against the frames handed in.
+	//Every file has a global palette over all frames so only the lossy setting moves the error.
+	void lossyLZW() {
+		heading("Lossy LZW");
+		for (auto const& [pattern, generate] : {
+			std::pair{ std::string("noisy gradient"), generator(&noisyGradientFrames) },
+			std::pair{ std::string("gradient"), generator(&gradientFrames) },
+			std::pair{ std::string("rainbow"), generator(&rainbowFrames) },
+			std::pair{ std::string("noise"), generator(&noiseFrames) } }) {
+			auto const frames = generate(640, 480, 10);
+			auto const palette = gif::colorTable(gif::globalPalette(frames));
+			auto const pixels = frames.size() * frames[0].size();
+
+			for (auto const maxError : { 0u, 8u, 16u, 24u, 32u, 48u, 64u }) {
+				auto enc = gif::encoder(640, 480, frames, palette);
+				enc.setLossy(maxError);
+				std::vector<byte> file;
+				auto const ms = time([&] {
+					enc.writeTo(file);
+					});
+
+				gif::decoder dec(file);
+				std::vector<gif::RGBpixel> canvas(frames[0].size());
+				double squared = 0;
+				for (size_t k = 0; dec.next(); k++) {
+					dec.composite(canvas.data());
+					for (size_t i = 0; i < canvas.size(); i++) {
+						auto const& a = canvas[i];
+						auto const& b = frames[k][i];
+						squared += double((a.r - b.r) * (a.r - b.r) + (a.g - b.g) * (a.g - b.g) + (a.b - b.b) * (a.b - b.b));
+					}
+				}
+				auto const mse = squared / double(pixels * 3);
+				std::ostringstream label;
+				label << pattern << " lossy " << maxError << " " << std::fixed << std::setprecision(1) << 10 * std::log10(255.0 * 255.0 / mse) << " dB";
+				report(label.str(), pixels, ms, file.size());
+			}
+		}
+	}
+
+	//What interlaced output costs, LZW reading the rows pass by pass through interlacedIndices against reading them
+	//in place and against copying them into that order first, and whole files. Times and sizes differ with the
+	//content too, since rows 8 apart follow each other in the stream, the copy shows what the view itself costs.
+	void interlacing() {
+		heading("Interlacing");
+		gif::encoder enc;
+		for (auto const& [width, height] : { std::pair{ 640, 480 }, std::pair{ 1920, 1080 } }) {
+			for (auto const& [pattern, generate] : inputs) {
+				auto const frames = generate(width, height, 10);
+				auto const label = pattern + " " + std::to_string(width) + "x" + std::to_string(height);
+				auto const palette = gif::colorTable(gif::quantize(frames[0], gif::quantizer::medianCut));
+				auto const indices = gif::mapPixels(frames[0], palette);
+
+				for (auto const interlaced : { false, true }) {
+					std::vector<byte> codes;
+					auto const ms = time([&] {
+						codes = enc.lzw_compress_strips(indices, 8, size_t(width), 1, 1, gif::dictionaryPolicy::adaptive, std::move(codes), nullptr, nullptr, interlaced);
+						});
+					report(label + (interlaced ? " lzw interlaced" : " lzw"), indices.size(), ms, codes.size(), 1);
+				}
+
+				std::vector<byte> reordered(indices.size());
+				std::vector<byte> codes;
+				auto const ms = time([&] {
+					for (size_t n = 0; n < size_t(height); n++) {
+						std::copy_n(indices.data() + gif::interlacedRow(n, size_t(height)) * size_t(width), size_t(width), reordered.data() + n * size_t(width));
+					}
+					codes = enc.lzw_compress(reordered, 8, gif::dictionaryPolicy::adaptive, std::move(codes));
+					});
+				report(label + " lzw reordered copy", indices.size(), ms, codes.size(), 1);
+
+				for (auto const interlaced : { false, true }) {
+					auto file = gif::encoder(uint16_t(width), uint16_t(height), frames);
+					file.setInterlaced(interlaced);
+					std::vector<byte> output;
+					auto const ms = time([&] {
+						file.writeTo(output);
+						});
+					report(label + " 10 frames" + (interlaced ? " interlaced" : ""), frames.size() * frames[0].size(), ms, output.size());
+				}
+			}
+		}
+	}
+
+	//Whole file encodes with the frames spread over 1 to N threads, the short animation has fewer frames than threads
+	void frameThreads() {
+		heading("Per frame threads");
+		//Always reaches 4 threads so the short animation has fewer frames than threads even on small machines
+		auto const cores = std::max(size_t(std::thread::hardware_concurrency()), size_t(4));
+
+		std::vector<size_t> counts;
+		for (size_t threads = 1; threads < cores; threads *= 2)
+			counts.push_back(threads);
+		counts.push_back(cores);
+
+		for (size_t const frameCount : { 16, 3 }) {
+			auto const frames = rainbowFrames(256, 256, frameCount);
+			auto const pixels = frames.size() * frames[0].size();
+			for (auto const threads : counts) {
+				auto enc = gif::encoder(256, 256, frames);
+				enc.setThreads(threads);
+				size_t bytes = 0;
+				auto const ms = time([&] {
+					bytes = enc.write().value().size();
+					}, 1);
+				report("rainbow " + std::to_string(frameCount) + "x256x256 threads " + std::to_string(threads), pixels, ms, bytes);
+			}
+		}
+	}
+
+	//Only the rectangle around the cursor gets mapped and compressed after the first frame
+	void deltaFrames() {
+		heading("Delta frames");
+		auto const frames = screenFrames(1280, 720, 30);
+		auto const pixels = frames.size() * frames[0].size();
+
+		for (bool const delta : { false, true }) {
+			auto enc = gif::encoder(1280, 720, frames);
+			enc.setDeltaFrames(delta);
+			size_t bytes = 0;
+			auto const ms = time([&] {
+				bytes = enc.write().value().size();
+				}, 1);
+			report(std::string("screen 30x1280x720 ") + (delta ? "delta" : "full"), pixels, ms, bytes);
+		}
+	}
+
+	//Unchanged pixels turn into runs of the transparent index, on their own and inside delta rectangles
+	void transparencyMasking() {
+		heading("Transparency masking");
+		auto const frames = screenFrames(1280, 720, 30);
+		auto const pixels = frames.size() * frames[0].size();
+
+		for (auto const& [name, delta, masking] : {
+			std::tuple{ std::string("full"), false, false },
+			std::tuple{ std::string("masked"), false, true },
+			std::tuple{ std::string("delta"), true, false },
+			std::tuple{ std::string("delta masked"), true, true } }) {
+			auto enc = gif::encoder(1280, 720, frames);
+			enc.setDeltaFrames(delta);
+			enc.setTransparencyMasking(masking);
+			size_t bytes = 0;
+			auto const ms = time([&] {
+				bytes = enc.write().value().size();
+				}, 1);
+			report("screen 30x1280x720 " + name, pixels, ms, bytes);
+		}
+	}
+
+	//Each picture held for five frames, the copies cost a hash and a compare instead of the whole pipeline
+	void duplicateFrames() {
+		heading("Duplicate frames");
+		std::vector<std::vector<gif::RGBpixel>> frames;
+		for (auto const& frame : rainbowFrames(640, 480, 6)) {
+			frames.insert(frames.end(), 5, frame);
+		}
+		auto const pixels = frames.size() * frames[0].size();
+
+		for (auto const& [name, drop, tolerance] : {
+			std::tuple{ std::string("kept"), false, uint8_t(0) },
+			std::tuple{ std::string("dropped"), true, uint8_t(0) },
+			std::tuple{ std::string("dropped within 2"), true, uint8_t(2) } }) {
+			auto enc = gif::encoder(640, 480, frames);
+			enc.setDelay(4);
+			enc.setDropDuplicates(drop, tolerance);
+			size_t bytes = 0;
+			auto const ms = time([&] {
+				bytes = enc.write().value().size();
+				}, 1);
+			report("held 30x640x480 " + name, pixels, ms, bytes);
+		}
+	}
+
+	//Captured BGRA frames read in place against converting each one to RGBpixel first, conversion is part of the timing
+	void pixelViews() {
+		heading("BGRA input");
+		auto const frames = screenFrames(1920, 1080, 10);
+		auto const pixels = frames.size() * frames[0].size();
+
+		std::vector<std::vector<uint8_t>> captured;
+		for (auto const& frame : frames) {
+			captured.emplace_back();
+			for (auto const& p : frame) {
+				captured.back().insert(captured.back().end(), { p.b, p.g, p.r, 255 });
+			}
+		}
+
+		size_t bytes = 0;
+		auto ms = time([&] {
+			std::vector<std::vector<gif::RGBpixel>> converted;
+			for (auto const& buffer : captured) {
+				converted.emplace_back(gif::pixelView(buffer.data(), 1920, 1080, gif::pixelFormat::bgra32).toVector());
+			}
+			auto enc = gif::encoder(1920, 1080, converted);
+			enc.setDeltaFrames(true);
+			bytes = enc.write().value().size();
+			}, 1);
+		report("screen 10x1920x1080 converted", pixels, ms, bytes);
+
+		ms = time([&] {
+			std::vector<gif::pixelView> views;
+			for (auto const& buffer : captured) {
+				views.emplace_back(buffer.data(), 1920, 1080, gif::pixelFormat::bgra32);
+			}
+			auto enc = gif::encoder(1920, 1080, views);
+			enc.setDeltaFrames(true);
+			bytes = enc.write().value().size();
+			}, 1);
+		report("screen 10x1920x1080 viewed", pixels, ms, bytes);
+	}
+
+	//One 4K frame cut into more and more strips, every strip costs some compression
+	void frameStrips() {
+		heading("Strips per frame");
+		gif::encoder enc;
+		auto const cores = size_t(std::max(1u, std::thread::hardware_concurrency()));
+
+		for (auto const& [pattern, generate] : {
+			std::pair{ std::string("gradient"), &gradientIndices },
+			std::pair{ std::string("noise"), &noiseIndices } }) {
+			auto const in = generate(3840, 2160, 8);
+
+			for (size_t const strips : { 1, 2, 4, 8, 16, 32 }) {
+				size_t bytes = 0;
+				auto const ms = time([&] {
+					bytes = enc.lzw_compress_strips(in, 8, 3840, strips, cores).size();
+					});
+				report(pattern + " 3840x2160 strips " + std::to_string(strips), in.size(), ms, bytes, 1);
+			}
+		}
+	}
+
+	//The histogram only grows with the pixel count while filling it, the cuts depend on the grid alone
+	void quantization() {
+		heading("Quantization");
+		for (uint16_t side : { 500, 1000, 2000 }) {
+			auto const frame = rainbowFrames(side, side, 1)[0];
+			auto const size = std::to_string(side) + "x" + std::to_string(side);
+
+			for (auto const& [name, mode] : {
+				std::pair{ std::string("median cut"), gif::quantizer::medianCut },
+				std::pair{ std::string("histogram"), gif::quantizer::histogram } }) {
+				size_t colors = 0;
+				auto const ms = time([&] {
+					colors = gif::quantize(frame, mode).size();
+					});
+				report("rainbow " + size + " " + name, frame.size(), ms, colors * 3);
+			}
+		}
+	}
+
+	//Every frame of an animation through one histogram, split over the cores
+	void globalPalette() {
+		heading("Global palette");
+		auto const frames = rainbowFrames(500, 500, 30);
+		auto const cores = size_t(std::max(1u, std::thread::hardware_concurrency()));
+
+		for (size_t workers : { size_t(1), cores }) {
+			size_t colors = 0;
+			auto const ms = time([&] {
+				colors = gif::globalPalette(frames, 256, workers).size();
+				});
+			report("rainbow 500x500x30 " + std::to_string(workers) + " workers", frames.size() * frames[0].size(), ms, colors * 3);
+		}
+	}
+
+	//Brute force search against the inverse colormap, the build of the map is part of the timing
+	void pixelMapping() {
+		heading("Pixel mapping");
+		auto const frame = rainbowFrames(1000, 1000, 1)[0];
+		auto const table = gif::colorTable(gif::palletize(frame));
+
+		size_t bytes = 0;
+		auto const bruteMs = time([&] {
+			bytes = gif::mapPixels(frame, table).size();
+			}, 1);
+		report("rainbow 1000x1000 brute force", frame.size(), bruteMs, bytes);
+
+		for (auto const& [name, mode] : {
+			std::pair{ std::string("exact"), gif::colorMapping::exact },
+			std::pair{ std::string("approximate"), gif::colorMapping::approximate } }) {
+			auto const ms = time([&] {
+				bytes = gif::mapPixels(frame, gif::inverseColorMap(table, mode)).size();
+				});
+			report("rainbow 1000x1000 " + name, frame.size(), ms, bytes);
+		}
+	}
+
+	//Brute force search per instruction set, levels the CPU lacks fall back and repeat the row below
+	void paletteSearch() {
+		heading("Palette search");
+		auto const frame = rainbowFrames(512, 512, 1)[0];
+
+		for (int depth = 2; depth <= 256; depth *= 2) {
+			auto palette = gif::palletize(frame, depth);
+			palette.resize(depth, palette.front());
+			auto const table = gif::colorTable(palette);
+			std::vector<byte> out(frame.size());
+
+			for (auto const& [name, level] : {
+				std::pair{ std::string("scalar"), gif::simdLevel::scalar },
+				std::pair{ std::string("sse4.1"), gif::simdLevel::sse41 },
+				std::pair{ std::string("avx2"), gif::simdLevel::avx2 } }) {
+				gif::paletteSearch const search(table, level);
+				auto const ms = time([&] {
+					search.map(frame.data(), frame.size(), out.data());
+					});
+				report(std::to_string(depth) + " colors " + name, frame.size(), ms, out.size());
+			}
+		}
+	}
+
+	//A server encoding one small animation after another with a fixed palette, allocations are per file
+	void steadyState() {
+		heading("Steady state");
+		auto const frames = rainbowFrames(320, 240, 10);
+		auto const palette = gif::colorTable(gif::globalPalette(frames));
+		std::vector<gif::pixelView> views;
+		for (auto const& frame : frames) {
+			views.emplace_back(frame, 320, 240);
+		}
+		auto const pixels = frames.size() * frames[0].size();
+		size_t const files = 20;
+
+		size_t bytes = 0;
+		auto before = allocations.load();
+		auto ms = time([&] {
+			for (size_t file = 0; file < files; file++) {
+				bytes = gif::encoder(320, 240, views, palette).write().value().size();
+			}
+			}, 1);
+		report("new encoder " + std::to_string((allocations - before) / files) + " allocations", pixels * files, ms, bytes);
+
+		gif::encoder enc(320, 240, views, palette);
+		std::vector<byte> out;
+		enc.writeTo(out);
+		before = allocations.load();
+		ms = time([&] {
+			for (size_t file = 0; file < files; file++) {
+				enc.reset(320, 240, views, palette);
+				bytes = enc.writeTo(out);
+			}
+			}, 1);
+		report("reset encoder " + std::to_string((allocations - before) / files) + " allocations", pixels * files, ms, bytes);
+
+		std::vector<std::byte> arena(1 << 20);
+		before = allocations.load();
+		ms = time([&] {
+			for (size_t file = 0; file < files; file++) {
+				std::pmr::monotonic_buffer_resource resource(arena.data(), arena.size(), std::pmr::null_memory_resource());
+				std::pmr::vector<byte> output(&resource);
+				enc.reset(320, 240, views, palette);
+				bytes = enc.writeTo(output);
+			}
+			}, 1);
+		report("reset encoder, pmr " + std::to_string((allocations - before) / files) + " allocations", pixels * files, ms, bytes);
+	}
+
+	//Every layout conversion and the planes both ways per instruction set, same to same is a plain memcpy
+	void pixelConversion() {
+		heading("Pixel conversion");
+		size_t const count = 1024 * 1024;
+		std::vector<uint8_t> in(count * 4), out(count * 4), r(count), g(count), b(count);
+		std::mt19937 random(7);
+		for (auto& value : in) {
+			value = uint8_t(random());
+		}
+
+		auto const name = [](gif::pixelFormat const format) {
+			return format == gif::pixelFormat::rgb24 ? std::string("rgb24") : (format == gif::pixelFormat::rgba32 ? "rgba32" : "bgra32");
+		};
+		auto const size = [](gif::pixelFormat const format) {
+			return format == gif::pixelFormat::rgb24 ? size_t(3) : size_t(4);
+		};
+
+		for (auto const& [from, to] : {
+			std::pair{ gif::pixelFormat::rgb24, gif::pixelFormat::rgb24 },
+			std::pair{ gif::pixelFormat::bgra32, gif::pixelFormat::rgb24 },
+			std::pair{ gif::pixelFormat::rgba32, gif::pixelFormat::rgb24 },
+			std::pair{ gif::pixelFormat::rgb24, gif::pixelFormat::bgra32 },
+			std::pair{ gif::pixelFormat::bgra32, gif::pixelFormat::rgba32 } }) {
+			for (auto const& [level, isa] : {
+				std::pair{ gif::simdLevel::scalar, std::string("scalar") },
+				std::pair{ gif::simdLevel::sse41, std::string("ssse3") },
+				std::pair{ gif::simdLevel::avx2, std::string("avx2") } }) {
+				gif::pixelConverter const converter(from, to, level);
+				auto const bytes = count * (size(from) + size(to));
+
+				auto ms = time([&] { converter.convert(in.data(), out.data(), count); }, 20);
+				reportBandwidth(name(from) + " to " + name(to) + " " + isa, bytes, ms);
+				if (to != gif::pixelFormat::rgb24)
+					continue;
+
+				ms = time([&] { converter.split(in.data(), count, r.data(), g.data(), b.data()); }, 20);
+				reportBandwidth(name(from) + " to planes " + isa, bytes, ms);
+				ms = time([&] { converter.join(r.data(), g.data(), b.data(), count, out.data()); }, 20);
+				reportBandwidth("planes to " + name(to) + " " + isa, bytes, ms);
+			}
+		}
+	}
+}
+
+//Benchmark [--csv] [suite...], no suites runs all of them
+int main(int argc, char** argv) {
+	std::vector<std::pair<std::string, void(*)()>> const suites{
+		{ "stages", &bench::stages },
+		{ "fullEncode", &bench::fullEncode },
+#if GIF_STATS
+		{ "stageBreakdown", &bench::stageBreakdown },
+#endif
+		{ "decoding", &bench::decoding },
+		{ "optimizer", &bench::optimizer },
+		{ "lzwPacking", &bench::lzwPacking },
+		{ "dictionaryPolicies", &bench::dictionaryPolicies },
+		{ "compressionLevels", &bench::compressionLevels },
+		{ "lossyLZW", &bench::lossyLZW },
+		{ "interlacing", &bench::interlacing },
+		{ "frameThreads", &bench::frameThreads },
+		{ "frameStrips", &bench::frameStrips },
+		{ "deltaFrames", &bench::deltaFrames },
+		{ "transparencyMasking", &bench::transparencyMasking },
+		{ "duplicateFrames", &bench::duplicateFrames },
+		{ "pixelViews", &bench::pixelViews },
+		{ "steadyState", &bench::steadyState },
+		{ "quantization", &bench::quantization },
+		{ "globalPalette", &bench::globalPalette },
+		{ "pixelMapping", &bench::pixelMapping },
+		{ "paletteSearch", &bench::paletteSearch },
+		{ "pixelConversion", &bench::pixelConversion } };
+
+	std::vector<std::string> wanted;
+	for (int i = 1; i < argc; i++) {
+		auto const arg = std::string(argv[i]);
+		if (arg == "--csv") {
+			bench::csv = true;
+		}
+		else if (std::none_of(suites.begin(), suites.end(), [&](auto const& s) { return s.first == arg; })) {
+			std::cerr << "Unknown suite " << arg << ", one of:";
+			for (auto const& s : suites) {
+				std::cerr << " " << s.first;
+			}
+			std::cerr << std::endl;
+			return 1;
+		}
+		else {
+			wanted.push_back(arg);
+		}
+	}
+
+	if (bench::csv)
+		std::cout << "suite,case,ms,pixels,pixels_per_s,bytes_per_s,output_bytes,ratio" << std::endl;
+	for (auto const& [name, run] : suites) {
+		if (wanted.empty() || std::find(wanted.begin(), wanted.end(), name) != wanted.end()) {
+			bench::suite = name;
+			run();
+		}
+	}
+	return 0;
+}
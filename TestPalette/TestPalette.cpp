@@ -1,4 +1,6 @@
 #include "CppUnitTest.h"
+//Every test runs with the statistics compiled in, they must never change the output
+#define GIF_STATS 1
 #include "../gif_animation/gif_animation.h"
 #include <algorithm>
 #include <bitset>
@@ -7,6 +9,8 @@
 #include <fstream>
 #include <filesystem>
 #include <cmath>
+#include <sstream>
+#include <memory_resource>
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 
@@ -275,6 +279,852 @@ namespace TestPalette
 			}
 		}
 
+
+		static auto stripes(uint16_t width, uint16_t height, uint8_t shift) -> std::vector<gif::RGBpixel> {
+			std::vector<gif::RGBpixel> out;
+			for (size_t y = 0; y < height; y++) {
+				for (size_t x = 0; x < width; x++) {
+					out.emplace_back(gif::RGBpixel{ uint8_t((x * 16) + shift), uint8_t(y * 16), uint8_t(shift) });
+				}
+			}
+			return out;
+		}
+
+		//Streaming the frames one by one has to give the exact same file as handing them over at once
+		TEST_METHOD(TestStreamMatchesBatch) {
+			std::vector<std::vector<gif::RGBpixel>> frames{ stripes(16, 12, 0), stripes(16, 12, 40), stripes(16, 12, 80) };
+
+			auto batch = gif::encoder(16, 12, frames).write().value();
+
+			std::ostringstream os;
+			auto stream = gif::streamEncoder(16, 12, gif::toStream(os));
+			for (auto const& frame : frames) {
+				stream.add_frame(frame);
+			}
+			stream.finish();
+			auto const streamed = os.str();
+
+			Assert::IsTrue(streamed.size() == batch.size());
+			Assert::IsTrue(std::equal(batch.begin(), batch.end(), streamed.begin(), [](byte lhs, char rhs) {
+				return lhs == byte(rhs);
+				}));
+		}
+
+		TEST_METHOD(TestParallelMatchesSerial) {
+			std::vector<std::vector<gif::RGBpixel>> frames;
+			for (uint8_t shift = 0; shift < 200; shift += 20) {
+				frames.emplace_back(stripes(16, 12, shift));
+			}
+
+			auto serial = gif::encoder(16, 12, frames).write().value();
+
+			auto enc = gif::encoder(16, 12, frames);
+			enc.setThreads(4);
+			auto parallel = enc.write().value();
+
+			Assert::IsTrue(serial == parallel);
+
+			//Fewer frames than threads, with and without strips
+			frames.resize(3);
+			auto const shortSerial = gif::encoder(16, 12, frames).write().value();
+			for (size_t const strips : { 1, 3 }) {
+				auto shortEnc = gif::encoder(16, 12, frames);
+				shortEnc.setThreads(4);
+				shortEnc.setStrips(strips);
+				auto const shortParallel = shortEnc.write().value();
+				if (strips == 1)
+					Assert::IsTrue(shortSerial == shortParallel);
+				auto const decoded = decodeFrames(shortParallel);
+				auto const expected = decodeFrames(shortSerial);
+				Assert::IsTrue(decoded.size() == expected.size());
+				for (size_t k = 0; k < decoded.size(); k++)
+					Assert::IsTrue(samePixels(decoded[k].first, expected[k].first));
+			}
+		}
+
+		TEST_METHOD(TestStreamSinkCalls) {
+			size_t calls = 0;
+			size_t total = 0;
+			auto stream = gif::streamEncoder(16, 12, gif::colorTable(gif::palletize(stripes(16, 12, 0))), [&](byte const*, size_t size) {
+				calls++;
+				total += size;
+				});
+
+			//Header goes out as soon as the palette is known
+			Assert::IsTrue(calls == 1);
+
+			stream.add_frame(stripes(16, 12, 0));
+			stream.add_frame(stripes(16, 12, 40));
+			Assert::IsTrue(calls == 3);
+
+			stream.finish();
+			Assert::IsTrue(calls == 4);
+
+			Assert::ExpectException<std::logic_error>([&] { stream.add_frame(stripes(16, 12, 0)); });
+			Assert::ExpectException<std::invalid_argument>([&] {
+				gif::streamEncoder(16, 12, [](byte const*, size_t) {}).add_frame(stripes(8, 8, 0));
+				});
+		}
+
+		struct image {
+			uint16_t left, top, width, height;
+			uint8_t flags;
+			uint16_t delay; //From the graphic control extension in front of it, if any
+		};
+
+		//Every image descriptor in the file, walks past tables, extensions and image data
+		static auto images(std::vector<byte> const& file) -> std::vector<image> {
+			auto const tableSize = [](uint8_t flags) -> size_t {
+				return (flags & 0x80) ? 3 * (size_t(2) << (flags & 7)) : 0;
+			};
+			auto const skipBlocks = [&](size_t at) {
+				while (file[at] != byte(0))
+					at += size_t(file[at]) + 1;
+				return at + 1;
+			};
+			auto const word = [&](size_t at) {
+				return uint16_t(uint16_t(file[at]) | (uint16_t(file[at + 1]) << 8));
+			};
+
+			std::vector<image> out;
+			uint16_t delay = 0;
+			size_t at = 13 + tableSize(uint8_t(file[10]));
+			while (file[at] != byte(0x3b)) {
+				if (file[at] == byte(0x21)) {
+					if (file[at + 1] == byte(0xf9))
+						delay = word(at + 4);
+					at = skipBlocks(at + 2);
+					continue;
+				}
+				auto const flags = uint8_t(file[at + 9]);
+				out.push_back(image{ word(at + 1), word(at + 3), word(at + 5), word(at + 7), flags, delay });
+				delay = 0;
+				at = skipBlocks(at + 10 + tableSize(flags) + 1);
+			}
+			return out;
+		}
+
+		//A small change only sends its rectangle, an unchanged frame a single pixel, streaming or not
+		TEST_METHOD(TestDeltaFrames) {
+			auto const first = stripes(32, 24, 0);
+			auto second = first;
+			for (size_t y = 7; y < 10; y++) {
+				for (size_t x = 10; x < 14; x++) {
+					second[y * 32 + x] = gif::RGBpixel{ 255, 255, 255 };
+				}
+			}
+			std::vector<std::vector<gif::RGBpixel>> frames{ first, second, second };
+
+			auto batch = gif::encoder(32, 24, frames);
+			batch.setDeltaFrames(true);
+			auto const file = batch.write().value();
+			auto const written = images(file);
+			Assert::IsTrue(written.size() == 3);
+			Assert::IsTrue(written[0].left == 0 && written[0].top == 0 && written[0].width == 32 && written[0].height == 24);
+			Assert::IsTrue(written[1].left == 10 && written[1].top == 7 && written[1].width == 4 && written[1].height == 3);
+			Assert::IsTrue(written[2].width == 1 && written[2].height == 1);
+
+			std::ostringstream os;
+			auto stream = gif::streamEncoder(32, 24, gif::toStream(os));
+			stream.setDeltaFrames(true);
+			for (auto const& frame : frames) {
+				stream.add_frame(frame);
+			}
+			stream.finish();
+			auto const streamed = os.str();
+			Assert::IsTrue(std::equal(file.begin(), file.end(), streamed.begin(), streamed.end(), [](byte lhs, char rhs) {
+				return lhs == byte(rhs);
+				}));
+		}
+
+		//Unchanged pixels turn transparent, which leaves long runs of one index for the compressor
+		TEST_METHOD(TestTransparencyMasking) {
+			auto const first = stripes(32, 24, 0);
+			auto second = first;
+			for (size_t i = 0; i < second.size(); i += 37) {
+				second[i] = gif::RGBpixel{ 255, 255, 255 };
+			}
+			std::vector<std::vector<gif::RGBpixel>> frames{ first, second, second };
+
+			auto plain = gif::encoder(32, 24, frames);
+			auto const plainFile = plain.write().value();
+
+			auto masked = gif::encoder(32, 24, frames);
+			masked.setTransparencyMasking(true);
+			masked.setDeltaFrames(true);
+			masked.setDelay(4);
+			auto const file = masked.write().value();
+			Assert::IsTrue(file.size() < plainFile.size());
+
+			std::ostringstream os;
+			auto stream = gif::streamEncoder(32, 24, gif::toStream(os));
+			stream.setTransparencyMasking(true);
+			stream.setDeltaFrames(true);
+			stream.setDelay(4);
+			for (auto const& frame : frames) {
+				stream.add_frame(frame);
+			}
+			stream.finish();
+			auto const streamed = os.str();
+			Assert::IsTrue(std::equal(file.begin(), file.end(), streamed.begin(), streamed.end(), [](byte lhs, char rhs) {
+				return lhs == byte(rhs);
+				}));
+
+			//Turned off again no frame may keep a transparent index, the palette's last entry is a color once more
+			masked.setTransparencyMasking(false);
+			auto const unmasked = masked.write().value();
+			auto fresh = gif::encoder(32, 24, frames);
+			fresh.setDeltaFrames(true);
+			fresh.setDelay(4);
+			Assert::IsTrue(unmasked == fresh.write().value());
+			gif::decoder dec(unmasked);
+			while (auto const frame = dec.next()) {
+				Assert::IsTrue(!frame.value().transparent);
+			}
+			auto const decoded = decodeFrames(unmasked);
+			auto const expected = decodeFrames(plainFile);
+			Assert::IsTrue(decoded.size() == expected.size());
+			for (size_t k = 0; k < decoded.size(); k++) {
+				Assert::IsTrue(samePixels(decoded[k].first, expected[k].first));
+			}
+		}
+
+		//Held frames collapse into the one before them, which then stays up for all of their delays
+		TEST_METHOD(TestDropDuplicates) {
+			auto const a = stripes(16, 12, 0);
+			auto const b = stripes(16, 12, 40);
+			auto nearB = b;
+			nearB[5].r += 2;
+			auto const c = stripes(16, 12, 80);
+			std::vector<std::vector<gif::RGBpixel>> frames{ a, a, a, b, nearB, c };
+
+			auto exact = gif::encoder(16, 12, frames);
+			exact.setDelay(5);
+			exact.setDropDuplicates(true);
+			auto const copies = images(exact.write().value());
+			Assert::IsTrue(copies.size() == 4);
+			Assert::IsTrue(copies[0].delay == 15 && copies[1].delay == 5 && copies[2].delay == 5 && copies[3].delay == 5);
+
+			auto near = gif::encoder(16, 12, frames);
+			near.setDelay(5);
+			near.setDropDuplicates(true, 2);
+			auto const similar = images(near.write().value());
+			Assert::IsTrue(similar.size() == 3);
+			Assert::IsTrue(similar[0].delay == 15 && similar[1].delay == 10 && similar[2].delay == 5);
+
+			//Every frame is written when duplicates are kept
+			auto all = gif::encoder(16, 12, frames);
+			all.setDelay(5);
+			Assert::IsTrue(images(all.write().value()).size() == frames.size());
+		}
+
+		//Bottom-up rows with padding at the end, the way a lot of capture APIs hand out frames
+		static auto asBGRA(std::vector<gif::RGBpixel> const& pixels, size_t width, size_t height, size_t rowBytes) -> std::vector<uint8_t> {
+			std::vector<uint8_t> out(rowBytes * height, 0xCD);
+			for (size_t y = 0; y < height; y++) {
+				for (size_t x = 0; x < width; x++) {
+					auto const& p = pixels[y * width + x];
+					auto* const at = out.data() + (height - 1 - y) * rowBytes + x * 4;
+					at[0] = p.b;
+					at[1] = p.g;
+					at[2] = p.r;
+					at[3] = 255;
+				}
+			}
+			return out;
+		}
+
+		//Views over the caller's buffers have to give the same file as handing over copies
+		TEST_METHOD(TestEncodeFromViews) {
+			std::vector<std::vector<gif::RGBpixel>> frames{ stripes(16, 12, 0), stripes(16, 12, 0), stripes(16, 12, 40), stripes(16, 12, 80) };
+			frames[3][20] = { 1, 2, 3 };
+
+			size_t const rowBytes = 16 * 4 + 12;
+			std::vector<std::vector<uint8_t>> buffers;
+			std::vector<gif::pixelView> views;
+			for (auto const& frame : frames) {
+				buffers.emplace_back(asBGRA(frame, 16, 12, rowBytes));
+			}
+			for (auto const& buffer : buffers) {
+				//Negative strides aren't supported, flipping is left to the caller
+				views.emplace_back(buffer.data(), 16, 12, gif::pixelFormat::bgra32, rowBytes);
+			}
+			std::vector<std::vector<gif::RGBpixel>> flipped;
+			for (auto const& frame : frames) {
+				flipped.emplace_back();
+				for (size_t y = 12; y-- > 0;) {
+					flipped.back().insert(flipped.back().end(), frame.begin() + y * 16, frame.begin() + (y + 1) * 16);
+				}
+			}
+
+			auto const configure = [](gif::encoder& enc) {
+				enc.setDeltaFrames(true);
+				enc.setTransparencyMasking(true);
+				enc.setDropDuplicates(true);
+				enc.setDelay(4);
+			};
+			auto copies = gif::encoder(16, 12, flipped);
+			configure(copies);
+			auto viewed = gif::encoder(16, 12, views);
+			configure(viewed);
+			auto const expected = copies.write().value();
+			Assert::IsTrue(viewed.write().value() == expected);
+
+			std::ostringstream os;
+			auto stream = gif::streamEncoder(16, 12, gif::toStream(os));
+			for (auto const& view : views) {
+				stream.add_frame(view);
+			}
+			stream.finish();
+			auto const plain = gif::encoder(16, 12, flipped).write().value();
+			auto const streamed = os.str();
+			Assert::IsTrue(std::equal(plain.begin(), plain.end(), streamed.begin(), streamed.end(), [](byte lhs, char rhs) {
+				return lhs == byte(rhs);
+				}));
+
+			Assert::ExpectException<std::invalid_argument>([&] {
+				gif::encoder(16, 12, std::vector<gif::pixelView>{ views[0].sub(gif::region{ 0, 0, 8, 8 }) });
+				});
+		}
+
+		//Writing into a kept buffer, or into an arena, and resetting the encoder must not change a byte
+		TEST_METHOD(TestWriteToReusesBuffer) {
+			std::vector<std::vector<gif::RGBpixel>> first{ stripes(16, 12, 0), stripes(16, 12, 40) };
+			std::vector<std::vector<gif::RGBpixel>> second{ stripes(16, 12, 80), stripes(16, 12, 80), stripes(16, 12, 120) };
+			auto const palette = gif::colorTable(gif::globalPalette(first));
+			auto const viewsOf = [](std::vector<std::vector<gif::RGBpixel>> const& frames) {
+				std::vector<gif::pixelView> views;
+				for (auto const& frame : frames) {
+					views.emplace_back(frame, 16, 12);
+				}
+				return views;
+			};
+
+			auto enc = gif::encoder(16, 12, viewsOf(first), palette);
+			auto const expected = enc.write().value();
+			std::vector<byte> out;
+			Assert::IsTrue(enc.writeTo(out) == expected.size() && out == expected);
+			auto const* const kept = out.data();
+			enc.writeTo(out);
+			Assert::IsTrue(out == expected && out.data() == kept);
+
+			std::vector<std::byte> arena(4096);
+			std::pmr::monotonic_buffer_resource resource(arena.data(), arena.size(), std::pmr::null_memory_resource());
+			std::pmr::vector<byte> pooled(&resource);
+			enc.writeTo(pooled);
+			Assert::IsTrue(std::equal(pooled.begin(), pooled.end(), expected.begin(), expected.end()));
+
+			enc.reset(16, 12, viewsOf(second), palette);
+			Assert::IsTrue(enc.write().value() == gif::encoder(16, 12, viewsOf(second), palette).write().value());
+			enc.reset(16, 12, viewsOf(second));
+			Assert::IsTrue(enc.write().value() == gif::encoder(16, 12, viewsOf(second)).write().value());
+			Assert::ExpectException<std::invalid_argument>([&] {
+				enc.reset(16, 12, std::vector<gif::pixelView>{});
+				});
+		}
+
+		//What a viewer shows for every frame, along with the frame's delay
+		static auto decodeFrames(std::vector<byte> const& file) -> std::vector<std::pair<std::vector<gif::RGBpixel>, uint16_t>> {
+			gif::decoder dec(file);
+			auto const [width, height] = dec.dimensions();
+			std::vector<gif::RGBpixel> canvas(size_t(width) * height);
+			std::vector<std::pair<std::vector<gif::RGBpixel>, uint16_t>> out;
+			while (auto const frame = dec.next()) {
+				dec.composite(canvas.data());
+				out.emplace_back(canvas, frame.value().delay);
+			}
+			return out;
+		}
+
+		static auto samePixels(std::vector<gif::RGBpixel> const& lhs, std::vector<gif::RGBpixel> const& rhs) -> bool {
+			return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](gif::RGBpixel const& a, gif::RGBpixel const& b) {
+				return a.r == b.r && a.g == b.g && a.b == b.b;
+				});
+		}
+
+		//With every color in the palette nothing is lost, whatever the encoder does to save bytes
+		TEST_METHOD(TestDecodeRoundTrip) {
+			std::vector<gif::RGBpixel> palette;
+			for (size_t i = 0; i < 256; i++) {
+				palette.push_back(gif::RGBpixel{ uint8_t(i), uint8_t(255 - i), uint8_t(i * 7) });
+			}
+			//The last entry is left out, masking gives it up for the transparent index
+			auto const frame = [&](size_t const shift) {
+				std::vector<gif::RGBpixel> out(32 * 24);
+				for (size_t i = 0; i < out.size(); i++) {
+					out[i] = palette[(i * 3 + (i / 32) * 5 + shift) % 250];
+				}
+				return out;
+			};
+			std::vector<std::vector<gif::RGBpixel>> frames{ frame(0), frame(0), frame(0), frame(9) };
+			for (size_t x = 4; x < 12; x++) {
+				frames[1][5 * 32 + x] = palette[200];
+			}
+			frames[2] = frames[1];
+
+			auto const matches = [&](std::vector<byte> const& file, std::vector<size_t> const& shown, uint16_t const delay) {
+				auto const decoded = decodeFrames(file);
+				Assert::IsTrue(decoded.size() == shown.size());
+				for (size_t k = 0; k < shown.size(); k++) {
+					Assert::IsTrue(samePixels(decoded[k].first, frames[shown[k]]));
+					Assert::IsTrue(decoded[k].second == delay * (k + 1 < shown.size() ? shown[k + 1] - shown[k] : frames.size() - shown[k]));
+				}
+			};
+
+			auto plain = gif::encoder(32, 24, frames, gif::colorTable(palette));
+			matches(plain.write().value(), { 0, 1, 2, 3 }, 0);
+
+			auto thrifty = gif::encoder(32, 24, frames, gif::colorTable(palette));
+			thrifty.setDeltaFrames(true);
+			thrifty.setTransparencyMasking(true);
+			thrifty.setDropDuplicates(true);
+			thrifty.setDelay(5);
+			matches(thrifty.write().value(), { 0, 1, 3 }, 5);
+
+			auto strips = gif::encoder(32, 24, frames, gif::colorTable(palette));
+			strips.setStrips(5);
+			strips.setThreads(3);
+			strips.setDictionaryPolicy(gif::dictionaryPolicy::clear);
+			matches(strips.write().value(), { 0, 1, 2, 3 }, 0);
+
+			std::ostringstream os;
+			auto stream = gif::streamEncoder(32, 24, gif::colorTable(palette), gif::toStream(os));
+			stream.setDeltaFrames(true);
+			stream.setTransparencyMasking(true);
+			for (auto const& f : frames) {
+				stream.add_frame(f);
+			}
+			stream.finish();
+			auto const streamed = os.str();
+			matches(std::vector<byte>(reinterpret_cast<byte const*>(streamed.data()), reinterpret_cast<byte const*>(streamed.data()) + streamed.size()),
+				{ 0, 1, 2, 3 }, 0);
+
+			//Fewer pixels than palette entries, every frame's own table holds its colors exactly
+			std::vector<std::vector<gif::RGBpixel>> small{ stripes(16, 12, 0), stripes(16, 12, 40) };
+			auto local = gif::encoder(16, 12, small);
+			local.setLocalColorTables(gif::localColorTables::always);
+			auto const file = local.write().value();
+			auto const decoded = decodeFrames(file);
+			Assert::IsTrue(decoded.size() == 2 && samePixels(decoded[0].first, small[0]) && samePixels(decoded[1].first, small[1]));
+
+			gif::decoder dec(file);
+			Assert::IsTrue(dec.next().value().localColorTable && dec.loops() == std::optional<uint16_t>(0));
+			std::vector<byte> indices(16 * 12);
+			dec.decode(indices.data());
+			Assert::IsTrue(gif::mapPixels(small[0], gif::colorTable(dec.palette())) == indices);
+		}
+
+		//Hand written file, the encoder itself only ever keeps frames
+		TEST_METHOD(TestDecodeDisposal) {
+			std::vector<gif::RGBpixel> palette(256);
+			for (size_t i = 0; i < 5; i++) {
+				palette[i] = gif::RGBpixel{ uint8_t(i * 50), 0, 0 };
+			}
+			std::vector<byte> file;
+			auto start = gif::appendTo(file, gif::header::size + gif::screenDescriptor::size);
+			gif::header().write(start);
+			gif::screenDescriptor(2, 1).write(start);
+			gif::writeColorTable(file, gif::colorTable(palette));
+
+			gif::encoder enc;
+			auto const image = [&](gif::region const& area, gif::disposal const method, std::vector<byte> const& indices) {
+				auto writer = gif::appendTo(file, gif::graphicControlExtension::size + gif::imageDescriptor::size);
+				gif::graphicControlExtension(0, method).write(writer);
+				auto descriptor = gif::imageDescriptor(area.width, area.height);
+				descriptor.setRegion(area);
+				descriptor.write(writer);
+				gif::writeImageData(file, enc.lzw_compress(indices, 8), 8);
+			};
+			image({ 0, 0, 2, 1 }, gif::disposal::keep, { byte(1), byte(1) });
+			image({ 0, 0, 1, 1 }, gif::disposal::previous, { byte(2) });
+			image({ 1, 0, 1, 1 }, gif::disposal::background, { byte(3) });
+			image({ 0, 0, 1, 1 }, gif::disposal::keep, { byte(4) });
+			file.push_back(byte(0x3b));
+
+			auto const decoded = decodeFrames(file);
+			std::vector<std::vector<gif::RGBpixel>> const expected{
+				{ palette[1], palette[1] },
+				{ palette[2], palette[1] },
+				{ palette[1], palette[3] },
+				{ palette[4], palette[0] } };
+			Assert::IsTrue(decoded.size() == expected.size());
+			for (size_t k = 0; k < expected.size(); k++) {
+				Assert::IsTrue(samePixels(decoded[k].first, expected[k]));
+			}
+
+			Assert::ExpectException<std::invalid_argument>([] {
+				std::vector<byte> const png{ byte(0x89), byte('P'), byte('N'), byte('G'), byte(0), byte(0), byte(0), byte(0), byte(0), byte(0), byte(0), byte(0), byte(0) };
+				gif::decoder dec(png);
+				});
+			Assert::ExpectException<std::out_of_range>([&] {
+				std::vector<byte> const truncated(file.begin(), file.end() - 4);
+				gif::decoder dec(truncated);
+				while (dec.next()) {}
+				});
+		}
+
+		//Rows go out pass by pass and come back where they belong, whatever else the encoder does
+		TEST_METHOD(TestInterlacedOutput) {
+			for (size_t height = 1; height <= 40; height++) {
+				std::vector<bool> seen(height);
+				for (size_t n = 0; n < height; n++) {
+					seen[gif::interlacedRow(n, height)] = true;
+				}
+				Assert::IsTrue(std::all_of(seen.begin(), seen.end(), [](bool const row) { return row; }));
+			}
+			Assert::IsTrue(gif::interlacedRow(1, 37) == 8 && gif::interlacedRow(5, 37) == 4 && gif::interlacedRow(10, 37) == 2);
+
+			std::vector<gif::RGBpixel> palette;
+			for (size_t i = 0; i < 256; i++) {
+				palette.push_back(gif::RGBpixel{ uint8_t(i), uint8_t(i * 5), uint8_t(255 - i) });
+			}
+			std::vector<std::vector<gif::RGBpixel>> frames(3, std::vector<gif::RGBpixel>(23 * 37));
+			for (size_t k = 0; k < frames.size(); k++) {
+				for (size_t i = 0; i < frames[k].size(); i++) {
+					frames[k][i] = palette[(i / 23 * 7 + (k == 2 && i % 23 < 5 ? 3 : 0)) % 250];
+				}
+			}
+
+			for (size_t mode = 0; mode < 3; mode++) {
+				auto enc = gif::encoder(23, 37, frames, gif::colorTable(palette));
+				enc.setInterlaced(true);
+				enc.setDeltaFrames(mode == 1);
+				enc.setTransparencyMasking(mode == 1);
+				enc.setStrips(mode == 2 ? 3 : 1);
+				auto const file = enc.write().value();
+				Assert::IsTrue(file != gif::encoder(23, 37, frames, gif::colorTable(palette)).write().value());
+				Assert::IsTrue(gif::decoder(file).next().value().interlaced);
+				auto const decoded = decodeFrames(file);
+				Assert::IsTrue(decoded.size() == frames.size());
+				for (size_t k = 0; k < frames.size(); k++) {
+					Assert::IsTrue(samePixels(decoded[k].first, frames[k]));
+				}
+			}
+
+			std::ostringstream os;
+			auto stream = gif::streamEncoder(23, 37, gif::colorTable(palette), gif::toStream(os));
+			stream.setInterlaced(true);
+			stream.setDeltaFrames(true);
+			for (auto const& frame : frames) {
+				stream.add_frame(frame);
+			}
+			stream.finish();
+			auto const streamed = os.str();
+			auto const decoded = decodeFrames(std::vector<byte>(reinterpret_cast<byte const*>(streamed.data()),
+				reinterpret_cast<byte const*>(streamed.data()) + streamed.size()));
+			Assert::IsTrue(decoded.size() == frames.size() && samePixels(decoded[2].first, frames[2]));
+		}
+
+		//Every pixel stays within the error of its color, or shows what exact mapping would have
+		TEST_METHOD(TestLossyLZW) {
+			std::vector<std::vector<gif::RGBpixel>> frames(3, std::vector<gif::RGBpixel>(64 * 48));
+			uint32_t seed = 7;
+			for (size_t k = 0; k < frames.size(); k++) {
+				for (size_t i = 0; i < frames[k].size(); i++) {
+					seed = seed * 1103515245 + 12345;
+					auto const noise = int((seed >> 16) % 13) - 6;
+					frames[k][i] = gif::RGBpixel{ uint8_t(std::clamp(int(i % 64 * 4) + noise, 0, 255)),
+						uint8_t(std::clamp(int(i / 64 * 5) + noise, 0, 255)), uint8_t(100 + k * 30 + noise) };
+				}
+			}
+			auto const palette = gif::colorTable(gif::globalPalette(frames));
+			auto const lossless = gif::encoder(64, 48, frames, palette).write().value();
+
+			for (auto const masked : { false, true }) {
+				auto const make = [&](uint32_t const maxError) {
+					auto enc = gif::encoder(64, 48, frames, palette);
+					enc.setDeltaFrames(masked);
+					enc.setTransparencyMasking(masked);
+					enc.setLossy(maxError);
+					return enc.write().value();
+				};
+				auto exact = make(0);
+				Assert::IsTrue(masked || exact == lossless);
+				auto const lossy = make(48);
+				Assert::IsTrue(lossy.size() * 5 < exact.size() * 4);
+
+				auto const decoded = decodeFrames(lossy);
+				Assert::IsTrue(decoded.size() == frames.size());
+				auto table = palette.table;
+				if (masked)
+					table.pop_back();
+				for (size_t k = 0; k < frames.size(); k++) {
+					auto const mapped = gif::mapPixels(frames[k], gif::colorTable(table));
+					for (size_t i = 0; i < frames[k].size(); i++) {
+						auto const& shown = decoded[k].first[i];
+						auto const& wanted = frames[k][i];
+						auto const error = (shown.r - wanted.r) * (shown.r - wanted.r) + (shown.g - wanted.g) * (shown.g - wanted.g) +
+							(shown.b - wanted.b) * (shown.b - wanted.b);
+						Assert::IsTrue(error <= 48 * 48 || samePixels({ shown }, { table[size_t(mapped[i])] }));
+					}
+				}
+			}
+
+			std::ostringstream os;
+			auto stream = gif::streamEncoder(64, 48, palette, gif::toStream(os));
+			stream.setLossy(48);
+			for (auto const& frame : frames) {
+				stream.add_frame(frame);
+			}
+			stream.finish();
+			auto const streamed = os.str();
+			Assert::IsTrue(streamed.size() * 5 < lossless.size() * 4);
+			Assert::IsTrue(decodeFrames(std::vector<byte>(reinterpret_cast<byte const*>(streamed.data()),
+				reinterpret_cast<byte const*>(streamed.data()) + streamed.size())).size() == frames.size());
+
+			gif::encoder enc;
+			auto const loosePalette = gif::lossyPalette(palette, 16);
+			auto const target = gif::lossyTarget{ gif::pixelView(frames[0], 64, 48), &loosePalette };
+			Assert::ExpectException<std::invalid_argument>([&] {
+				enc.lzw_compress(std::vector<byte>(10), 8, gif::dictionaryPolicy::adaptive, {}, nullptr, &target);
+				});
+		}
+
+		//Frames that change small parts of the screen, with a palette holding every color exactly
+		static auto sparseAnimation() -> std::pair<std::vector<std::vector<gif::RGBpixel>>, std::vector<byte>> {
+			std::vector<gif::RGBpixel> palette;
+			for (size_t i = 0; i < 256; i++) {
+				palette.push_back(gif::RGBpixel{ uint8_t(i), uint8_t(i * 3), uint8_t(255 - i) });
+			}
+			std::vector<std::vector<gif::RGBpixel>> frames(5, std::vector<gif::RGBpixel>(32 * 24));
+			for (size_t i = 0; i < frames[0].size(); i++) {
+				frames[0][i] = palette[(i + i / 32) % 250];
+			}
+			for (size_t k = 1; k < frames.size(); k++) {
+				frames[k] = frames[k - 1];
+				for (size_t y = 2 * k; y < 2 * k + 6; y++) {
+					for (size_t x = 5 * k; x < 5 * k + 7; x++) {
+						frames[k][y * 32 + x] = palette[(x * y + k * 40) % 250];
+					}
+				}
+			}
+			auto enc = gif::encoder(32, 24, frames, gif::colorTable(palette));
+			enc.setDeltaFrames(true);
+			enc.setTransparencyMasking(true);
+			enc.setDelay(5);
+			return { frames, enc.write().value() };
+		}
+
+		//Without edits to the pixels the frames are copied as they are
+		TEST_METHOD(TestOptimizerPassThrough) {
+			auto const [frames, file] = sparseAnimation();
+			gif::optimizer opt(file);
+			Assert::IsTrue(opt.frameCount() == frames.size());
+			Assert::IsTrue(opt.write() == file);
+			Assert::IsTrue(opt.copiedFrames() == frames.size());
+
+			opt.setLoops(std::nullopt);
+			opt.setDelay(2, 40);
+			auto const rewritten = opt.write();
+			Assert::IsTrue(opt.copiedFrames() == frames.size() && rewritten.size() < file.size());
+			Assert::IsTrue(!gif::decoder(rewritten).loops());
+			auto const decoded = decodeFrames(rewritten);
+			Assert::IsTrue(decoded.size() == frames.size());
+			for (size_t k = 0; k < frames.size(); k++) {
+				Assert::IsTrue(samePixels(decoded[k].first, frames[k]) && decoded[k].second == (k == 2 ? 40 : 5));
+			}
+
+			Assert::ExpectException<std::out_of_range>([&] {
+				opt.setDelay(frames.size(), 1);
+				});
+			Assert::ExpectException<std::invalid_argument>([&] {
+				opt.cropFrame(1, gif::region{ 0, 30, 8, 8 });
+				});
+		}
+
+		//Frames that relied on a dropped or cropped frame are drawn again, every frame shown looks like it did
+		TEST_METHOD(TestOptimizerEdits) {
+			auto const [frames, file] = sparseAnimation();
+			auto const shows = [&](std::vector<byte> const& out, std::vector<size_t> const& kept, std::vector<uint16_t> const& delays) {
+				auto const decoded = decodeFrames(out);
+				Assert::IsTrue(decoded.size() == kept.size());
+				for (size_t k = 0; k < kept.size(); k++) {
+					Assert::IsTrue(samePixels(decoded[k].first, frames[kept[k]]) && decoded[k].second == delays[k]);
+				}
+			};
+
+			gif::optimizer middle(file);
+			middle.dropFrame(2);
+			shows(middle.write(), { 0, 1, 3, 4 }, { 5, 10, 5, 5 });
+			Assert::IsTrue(middle.copiedFrames() == 3);
+			//Up to the frame that draws over what was dropped, the last frame is past it
+			Assert::IsTrue(middle.decodedFrames() == 4);
+
+			gif::optimizer first(file);
+			first.dropFrame(0);
+			first.dropFrame(1);
+			shows(first.write(), { 2, 3, 4 }, { 15, 5, 5 });
+
+			first.dropFrame(2);
+			first.dropFrame(3);
+			first.dropFrame(4);
+			Assert::ExpectException<std::invalid_argument>([&] {
+				first.write();
+				});
+
+			//A cropped frame shows as the decoder draws it with the same crop
+			auto const crop = gif::region{ 12, 7, 4, 3 };
+			gif::optimizer cropped(file);
+			cropped.cropFrame(3, crop);
+			auto const decoded = decodeFrames(cropped.write());
+			gif::decoder dec(file);
+			std::vector<gif::RGBpixel> canvas(32 * 24);
+			for (size_t k = 0; dec.next(); k++) {
+				dec.composite(canvas.data(), k == 3 ? std::optional<gif::region>(crop) : std::nullopt);
+				Assert::IsTrue(samePixels(decoded[k].first, canvas));
+			}
+			Assert::IsTrue(!samePixels(decoded[3].first, frames[3]) && samePixels(decoded[4].first, canvas));
+			Assert::IsTrue(cropped.copiedFrames() == 4 && cropped.decodedFrames() == 1);
+
+			//Opaque full screen frames hide everything before them, the one after the dropped frame is copied as it is
+			auto const full = gif::encoder(32, 24, frames).write().value();
+			gif::optimizer late(full);
+			late.dropFrame(3);
+			auto const original = decodeFrames(full);
+			auto const rewritten = decodeFrames(late.write());
+			Assert::IsTrue(rewritten.size() == 4 && samePixels(rewritten[3].first, original[4].first));
+			Assert::IsTrue(late.copiedFrames() == 4 && late.decodedFrames() == 0);
+
+			//A cropped frame after it has to be drawn again, from the last of them on
+			late.cropFrame(4, crop);
+			auto const tail = decodeFrames(late.write());
+			gif::decoder replay(full);
+			std::vector<gif::RGBpixel> screen(32 * 24);
+			for (size_t k = 0; replay.next(); k++)
+				replay.composite(screen.data(), k == 4 ? std::optional<gif::region>(crop) : std::nullopt);
+			Assert::IsTrue(tail.size() == 4 && samePixels(tail[3].first, screen));
+			Assert::IsTrue(late.copiedFrames() == 3 && late.decodedFrames() == 2);
+		}
+
+		//The entries that fill a short palette up to 256 are never mapped to, near black pixels included
+		TEST_METHOD(TestShortCallerPalette)
+		{
+			std::vector<gif::RGBpixel> const palette{ { 200, 0, 0 }, { 0, 200, 0 }, { 0, 0, 200 } };
+			std::vector<std::vector<gif::RGBpixel>> frames(2, std::vector<gif::RGBpixel>(16 * 12));
+			for (size_t i = 0; i < frames[0].size(); i++) {
+				auto const level = uint8_t(i % 4 == 0 ? 150 : 10);
+				frames[0][i] = gif::RGBpixel{ level, uint8_t(i % 3 == 0 ? level : 0), 10 };
+			}
+			frames[1] = frames[0];
+			for (size_t i = 0; i < frames[1].size(); i += 5) {
+				frames[1][i] = gif::RGBpixel{ 5, 5, 5 };
+			}
+
+			auto const onlyPalette = [&](std::vector<byte> const& file) {
+				for (auto const& [shown, delay] : decodeFrames(file)) {
+					Assert::IsTrue(std::all_of(shown.begin(), shown.end(), [&](gif::RGBpixel const& p) {
+						return std::any_of(palette.begin(), palette.end(), [&](gif::RGBpixel const& q) {
+							return p.r == q.r && p.g == q.g && p.b == q.b;
+							});
+						}));
+				}
+			};
+
+			for (auto const masking : { false, true }) {
+				for (auto const mapping : { gif::colorMapping::exact, gif::colorMapping::approximate }) {
+					auto enc = gif::encoder(16, 12, frames, gif::colorTable(palette));
+					enc.setTransparencyMasking(masking);
+					enc.setColorMapping(mapping);
+					onlyPalette(enc.write().value());
+
+					std::ostringstream os;
+					auto stream = gif::streamEncoder(16, 12, gif::colorTable(palette), gif::toStream(os));
+					stream.setTransparencyMasking(masking);
+					stream.setColorMapping(mapping);
+					for (auto const& frame : frames) {
+						stream.add_frame(frame);
+					}
+					stream.finish();
+					auto const streamed = os.str();
+					std::vector<byte> file(streamed.size());
+					std::transform(streamed.begin(), streamed.end(), file.begin(), [](char const c) {
+						return byte(c);
+						});
+					onlyPalette(file);
+				}
+			}
+
+			//A reset to a longer palette maps to its new entries
+			std::vector<gif::RGBpixel> const longer{ { 200, 0, 0 }, { 0, 200, 0 }, { 0, 0, 200 }, { 10, 10, 10 } };
+			auto enc = gif::encoder(16, 12, frames, gif::colorTable(palette));
+			onlyPalette(enc.write().value());
+			std::vector<gif::pixelView> const views{ gif::pixelView(frames[0], 16, 12) };
+			enc.reset(16, 12, views, gif::colorTable(longer));
+			auto const decoded = decodeFrames(enc.write().value());
+			Assert::IsTrue(decoded[0].first[1].r == 10 && decoded[0].first[1].b == 10);
+			enc.reset(16, 12, views, gif::colorTable(palette));
+			onlyPalette(enc.write().value());
+
+			Assert::ExpectException<std::invalid_argument>([] {
+				gif::encoder(16, 12, std::vector<std::vector<gif::RGBpixel>>{}, gif::colorTable(std::vector<gif::RGBpixel>{}));
+				});
+		}
+
+		//The palette comes from the first frame, so only the second one is worth a table of its own
+		TEST_METHOD(TestAdaptiveLocalColorTables) {
+			std::vector<gif::RGBpixel> reds, blues;
+			for (uint8_t i = 0; i < 255; i++) {
+				reds.push_back({ i, 0, 0 });
+				blues.push_back({ 0, 0, i });
+			}
+			std::vector<std::vector<gif::RGBpixel>> frames{ reds, blues };
+
+			auto plain = gif::encoder(15, 17, frames);
+			auto const globalOnly = images(plain.write().value());
+			Assert::IsTrue((globalOnly[0].flags & 0x80) == 0 && (globalOnly[1].flags & 0x80) == 0);
+
+			auto adaptive = gif::encoder(15, 17, frames);
+			adaptive.setLocalColorTables(gif::localColorTables::adaptive);
+			auto const written = images(adaptive.write().value());
+			Assert::IsTrue(written.size() == 2);
+			Assert::IsTrue((written[0].flags & 0x80) == 0);
+			Assert::IsTrue((written[1].flags & 0x80) != 0 && (written[1].flags & 7) == 7);
+
+			//Nothing is worth a table at an absurd price
+			auto stingy = gif::encoder(15, 17, frames);
+			stingy.setLocalColorTables(gif::localColorTables::adaptive, 1e12);
+			auto const none = images(stingy.write().value());
+			Assert::IsTrue((none[1].flags & 0x80) == 0);
+		}
+
+		//Tables picked for one write() are not left on the frames, the next write() decides again
+		TEST_METHOD(TestLocalColorTablesPerWrite) {
+			std::vector<gif::RGBpixel> reds, blues;
+			for (uint8_t i = 0; i < 255; i++) {
+				reds.push_back({ i, 0, 0 });
+				blues.push_back({ 0, 0, i });
+			}
+			auto greens = blues;
+			for (size_t i = 40; i < 80; i++) {
+				greens[i] = { 0, uint8_t(i * 3), 0 };
+			}
+			std::vector<std::vector<gif::RGBpixel>> frames{ reds, blues, greens };
+
+			auto const fresh = [&](gif::localColorTables const mode, bool const delta) {
+				auto enc = gif::encoder(15, 17, frames);
+				enc.setLocalColorTables(mode);
+				enc.setDeltaFrames(delta);
+				return enc.write().value();
+			};
+
+			auto enc = gif::encoder(15, 17, frames);
+			enc.setLocalColorTables(gif::localColorTables::always);
+			enc.setDeltaFrames(true);
+			Assert::IsTrue(enc.write().value() == fresh(gif::localColorTables::always, true));
+			enc.setLocalColorTables(gif::localColorTables::never);
+			Assert::IsTrue(enc.write().value() == fresh(gif::localColorTables::never, true));
+
+			//Without delta frames the tables come from whole frames and not from the last write's rectangles
+			enc.setLocalColorTables(gif::localColorTables::always);
+			enc.write();
+			enc.setDeltaFrames(false);
+			Assert::IsTrue(enc.write().value() == fresh(gif::localColorTables::always, false));
+
+			enc.setLocalColorTables(gif::localColorTables::adaptive);
+			enc.write();
+			enc.setLocalColorTables(gif::localColorTables::never);
+			Assert::IsTrue(enc.write().value() == fresh(gif::localColorTables::never, false));
+		}
 	};
 	TEST_CLASS(Internals)
 	{
@@ -295,6 +1145,105 @@ namespace TestPalette
 			Assert::IsTrue(std::equal(image.begin(), image.end(), palette.begin()));
 		}
 
+		//Ties on the split channel are broken by the other channels, so shuffling the input can't change the palette
+		TEST_METHOD(TestPalletizeOrderIndependent)
+		{
+			std::vector<gif::RGBpixel> image;
+			for (uint8_t i = 0; i < 200; i++) {
+				image.push_back({ uint8_t(i % 4 * 60), uint8_t(i % 7 * 30), uint8_t(i % 5 * 50) });
+			}
+			auto reversed = image;
+			std::reverse(reversed.begin(), reversed.end());
+			auto rotated = image;
+			std::rotate(rotated.begin(), rotated.begin() + 77, rotated.end());
+
+			auto const palette = gif::palletize(image, 16);
+			auto const same = [&](std::vector<gif::RGBpixel> const& other) {
+				return std::equal(palette.begin(), palette.end(), other.begin(), other.end(), [](auto const& i, auto const& j) {
+					return i.r == j.r && i.g == j.g && i.b == j.b;
+					});
+			};
+			Assert::IsTrue(same(gif::palletize(reversed, 16)));
+			Assert::IsTrue(same(gif::palletize(rotated, 16)));
+		}
+
+		//Every color sits alone in its cell, so the weighted cuts land where the exact ones do
+		TEST_METHOD(TestHistogramPalletize)
+		{
+			std::vector<gif::RGBpixel> image{
+				{10,20,30},
+			{40,50,60},
+			{70,80,90},
+			{100,110,120},
+			{130,140,150},
+			{160,170,180},
+			{190,200,210},
+			{220,230,240}
+			};
+			auto palette = gif::quantize(image, gif::quantizer::histogram, 8);
+			Assert::IsTrue(std::equal(image.begin(), image.end(), palette.begin()));
+		}
+
+		//Colors sharing a cell average by pixel count, not by how many distinct colors there are
+		TEST_METHOD(TestHistogramWeightedAverage)
+		{
+			gif::colorHistogram histogram;
+			histogram.add(std::vector<gif::RGBpixel>(3, { 8,16,24 }));
+			histogram.add(std::vector<gif::RGBpixel>(1, { 12,16,24 }));
+			auto const palette = histogram.palette(1);
+			Assert::IsTrue(palette.size() == 1);
+			Assert::IsTrue(palette[0].r == 9 && palette[0].g == 16 && palette[0].b == 24);
+
+			//One heavy cell doesn't take the other half of the cut with it
+			histogram.add(std::vector<gif::RGBpixel>(1000, { 200,16,24 }));
+			auto const split = histogram.palette(2);
+			Assert::IsTrue(split[0].r == 9 && split[1].r == 200);
+		}
+
+		//Colors that only show up in later frames still make it into the palette
+		TEST_METHOD(TestGlobalPalette)
+		{
+			std::vector<std::vector<gif::RGBpixel>> frames{
+				std::vector<gif::RGBpixel>(64, { 255,0,0 }),
+				std::vector<gif::RGBpixel>(64, { 0,255,0 }),
+				std::vector<gif::RGBpixel>(64, { 0,0,255 }),
+			};
+			auto const palette = gif::globalPalette(frames, 4);
+			for (auto const& frame : frames) {
+				auto const& color = frame.front();
+				Assert::IsTrue(std::any_of(palette.begin(), palette.end(), [&](auto const& p) {
+					return p.r == color.r && p.g == color.g && p.b == color.b;
+					}));
+			}
+
+			auto const parallel = gif::globalPalette(frames, 4, 3);
+			Assert::IsTrue(std::equal(palette.begin(), palette.end(), parallel.begin(), parallel.end(), [](auto const& i, auto const& j) {
+				return i.r == j.r && i.g == j.g && i.b == j.b;
+				}));
+		}
+
+		TEST_METHOD(TestDirtyRegion)
+		{
+			std::vector<gif::RGBpixel> before(6 * 4);
+			auto const changed = [&](std::vector<std::pair<size_t, size_t>> const& at) {
+				auto after = before;
+				for (auto const& [x, y] : at) {
+					after[y * 6 + x].g = 1;
+				}
+				return gif::dirtyRegion(before, after, 6, 4);
+			};
+			auto const is = [](gif::region const& r, uint16_t left, uint16_t top, uint16_t width, uint16_t height) {
+				return r.left == left && r.top == top && r.width == width && r.height == height;
+			};
+
+			Assert::IsTrue(is(changed({}), 0, 0, 1, 1));
+			Assert::IsTrue(is(changed({ { 0, 0 } }), 0, 0, 1, 1));
+			Assert::IsTrue(is(changed({ { 5, 3 } }), 5, 3, 1, 1));
+			Assert::IsTrue(is(changed({ { 5, 0 }, { 0, 3 } }), 0, 0, 6, 4));
+			Assert::IsTrue(is(changed({ { 2, 1 }, { 4, 1 }, { 3, 2 } }), 2, 1, 3, 2));
+			Assert::IsTrue(is(gif::dirtyRegion(before, std::vector<gif::RGBpixel>(5), 6, 4), 0, 0, 6, 4));
+		}
+
 		//We want our palletization code to support creating palettes larger than
 		//needed to represent the original data. Extra space is padded with zeroes.
 		TEST_METHOD(TestMethodPalletizeOversized)
@@ -331,6 +1280,177 @@ namespace TestPalette
 			auto mapped = gif::mapPixels(image, palette);
 		}
 
+		static auto noisePixels(size_t const count, uint32_t seed) -> std::vector<gif::RGBpixel> {
+			std::vector<gif::RGBpixel> out(count);
+			for (auto& p : out) {
+				seed = seed * 1103515245 + 12345;
+				p = gif::RGBpixel{ uint8_t(seed >> 24), uint8_t(seed >> 16), uint8_t(seed >> 8) };
+			}
+			return out;
+		}
+
+		TEST_METHOD(TestPixelViewFormats)
+		{
+			size_t const width = 7;
+			size_t const height = 5;
+			auto const pixels = noisePixels(width * height, 11);
+
+			//Alpha is garbage on purpose, it must never matter
+			size_t const rowBytes = width * 4 + 3;
+			std::vector<uint8_t> rgba(rowBytes * height), bgra(rowBytes * height);
+			for (size_t y = 0; y < height; y++) {
+				for (size_t x = 0; x < width; x++) {
+					auto const& p = pixels[y * width + x];
+					auto* const a = rgba.data() + y * rowBytes + x * 4;
+					auto* const b = bgra.data() + y * rowBytes + x * 4;
+					a[0] = p.r; a[1] = p.g; a[2] = p.b; a[3] = uint8_t(x * y);
+					b[0] = p.b; b[1] = p.g; b[2] = p.r; b[3] = uint8_t(x + y);
+				}
+			}
+
+			auto const same = [](std::vector<gif::RGBpixel> const& lhs, std::vector<gif::RGBpixel> const& rhs) {
+				return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](auto const& i, auto const& j) {
+					return i.r == j.r && i.g == j.g && i.b == j.b;
+					});
+			};
+
+			auto const palette = gif::colorTable(gif::palletize(pixels, 16));
+			auto const expected = gif::mapPixels(pixels, palette);
+			auto const area = gif::region{ 2, 1, 4, 3 };
+			for (auto const& view : { gif::pixelView(pixels, width, height),
+				gif::pixelView(rgba.data(), width, height, gif::pixelFormat::rgba32, rowBytes),
+				gif::pixelView(bgra.data(), width, height, gif::pixelFormat::bgra32, rowBytes) }) {
+				Assert::IsTrue(same(view.toVector(), pixels));
+				Assert::IsTrue(gif::mapPixels(view, palette) == expected);
+				Assert::IsTrue(gif::similarFrames(view, gif::pixelView(pixels, width, height), 0));
+
+				auto const inner = view.sub(area).toVector();
+				Assert::IsTrue(inner.size() == 12);
+				for (size_t y = 0; y < area.height; y++) {
+					for (size_t x = 0; x < area.width; x++) {
+						auto const& p = pixels[(area.top + y) * width + area.left + x];
+						auto const& q = inner[y * area.width + x];
+						Assert::IsTrue(p.r == q.r && p.g == q.g && p.b == q.b);
+					}
+				}
+			}
+
+			Assert::ExpectException<std::invalid_argument>([&] { gif::pixelView(rgba.data(), width, height, gif::pixelFormat::rgba32, width * 3); });
+			Assert::ExpectException<std::invalid_argument>([&] { gif::pixelView(pixels, width + 1, height); });
+		}
+
+		TEST_METHOD(TestInverseColorMapExact)
+		{
+			auto const image = noisePixels(5000, 1);
+			auto const pixels = noisePixels(50000, 2);
+
+			for (int depth : { 2, 16, 256 }) {
+				auto palette = gif::palletize(image, depth);
+				//Duplicate entries tie, the lowest index has to win like it does in the brute force search
+				palette.back() = palette.front();
+				auto const table = gif::colorTable(palette);
+
+				Assert::IsTrue(gif::mapPixels(pixels, table) == gif::mapPixels(pixels, gif::inverseColorMap(table)));
+			}
+		}
+
+		TEST_METHOD(TestPaletteSearchLevels)
+		{
+			auto const image = noisePixels(5000, 3);
+			auto const pixels = noisePixels(20000, 4);
+
+			//Sizes around the 4 and 8 entry vector widths exercise the padding
+			for (int depth : { 1, 2, 3, 7, 8, 9, 100, 256 }) {
+				auto palette = gif::palletize(image, depth);
+				palette.resize(depth, palette.front());
+				palette.back() = palette.front();
+				auto const table = gif::colorTable(palette);
+
+				std::vector<byte> expected(pixels.size());
+				gif::paletteSearch(table, gif::simdLevel::scalar).map(pixels.data(), pixels.size(), expected.data());
+
+				for (auto level : { gif::simdLevel::sse41, gif::simdLevel::avx2 }) {
+					std::vector<byte> mapped(pixels.size());
+					gif::paletteSearch(table, level).map(pixels.data(), pixels.size(), mapped.data());
+					Assert::IsTrue(mapped == expected);
+				}
+			}
+		}
+
+		//Every pair of layouts, planes both ways, with counts that leave tails behind the vector loops
+		TEST_METHOD(TestPixelConverterLevels)
+		{
+			auto const formats = { gif::pixelFormat::rgb24, gif::pixelFormat::rgba32, gif::pixelFormat::bgra32 };
+			auto const noise = noisePixels(200, 5);
+			auto const* const bytes = reinterpret_cast<uint8_t const*>(noise.data());
+
+			for (size_t count : { 0, 1, 5, 16, 18, 31, 34, 100, 150 }) {
+				for (auto from : formats) {
+					for (auto to : formats) {
+						auto const size = count * (to == gif::pixelFormat::rgb24 ? 3 : 4);
+						gif::pixelConverter const reference(from, to, gif::simdLevel::scalar);
+						std::vector<uint8_t> expected(size), r(count), g(count), b(count);
+						reference.convert(bytes, expected.data(), count);
+						reference.split(bytes, count, r.data(), g.data(), b.data());
+
+						for (auto level : { gif::simdLevel::sse41, gif::simdLevel::avx2 }) {
+							gif::pixelConverter const converter(from, to, level);
+							std::vector<uint8_t> converted(size), joined(size), r2(count), g2(count), b2(count);
+							converter.convert(bytes, converted.data(), count);
+							converter.split(bytes, count, r2.data(), g2.data(), b2.data());
+							converter.join(r.data(), g.data(), b.data(), count, joined.data());
+							Assert::IsTrue(converted == expected);
+							Assert::IsTrue(r2 == r && g2 == g && b2 == b);
+
+							//Planes carry no alpha, everything else has to survive the round trip
+							for (size_t i = 0; i < size; i++) {
+								if (to != gif::pixelFormat::rgb24 && i % 4 == 3)
+									Assert::IsTrue(joined[i] == 255);
+								else
+									Assert::IsTrue(joined[i] == expected[i]);
+							}
+						}
+					}
+				}
+			}
+
+			//The planes really are red, green and blue
+			std::vector<uint8_t> r(4), g(4), b(4);
+			uint8_t const bgra[] = { 1, 2, 3, 0, 4, 5, 6, 0, 7, 8, 9, 0, 10, 11, 12, 0 };
+			gif::pixelConverter(gif::pixelFormat::bgra32).split(bgra, 4, r.data(), g.data(), b.data());
+			Assert::IsTrue(r == std::vector<uint8_t>{ 3, 6, 9, 12 } && b == std::vector<uint8_t>{ 1, 4, 7, 10 });
+		}
+
+		TEST_METHOD(TestInverseColorMapApproximate)
+		{
+			auto const palette = gif::palletize(noisePixels(5000, 1), 16);
+			auto const mapped = gif::mapPixels(noisePixels(50000, 2), gif::inverseColorMap(palette, gif::colorMapping::approximate));
+
+			Assert::IsTrue(std::all_of(mapped.begin(), mapped.end(), [](byte b) { return uint8_t(b) < 16; }));
+		}
+
+		TEST_METHOD(TestGraphicControlExtension)
+		{
+			auto control = gif::graphicControlExtension(10);
+			control.setTransparent(255);
+			auto const expected = std::vector<byte>{ byte(0x21), byte(0xf9), byte(0x04), byte(0x05), byte(0x0a), byte(0x00), byte(0xff), byte(0x00) };
+			Assert::IsTrue(control.write() == expected);
+
+			auto const restore = gif::graphicControlExtension(300, gif::disposal::previous).write();
+			Assert::IsTrue(restore[3] == byte(0x0c) && restore[4] == byte(0x2c) && restore[5] == byte(0x01));
+		}
+
+		TEST_METHOD(TestByteWriterBounds)
+		{
+			std::array<byte, 8> data{};
+			auto writer = gif::byteWriter(data.data(), data.size());
+			gif::graphicControlExtension(10).write(writer);
+			Assert::IsTrue(writer.size() == data.size());
+			Assert::ExpectException<std::length_error>([&] {
+				writer.put(byte(0x3b));
+				});
+		}
+
 		TEST_METHOD(TestPixel)
 		{
 			auto expected = std::vector<byte>{ byte(0x55), byte(0xff), byte(0x00) };
@@ -390,6 +1510,190 @@ namespace TestPalette
 			}, encoded);
 		}
 
+		//Index pairs which happen to spell out the clear and end codes have to be regular strings
+		TEST_METHOD(TestLZWSentinelIndices)
+		{
+			gif::encoder enc;
+
+			auto in = std::vector<byte>{ byte(0x01), byte(0x00), byte(0x01), byte(0x00) };
+			auto expected = std::vector<std::bitset<9>>{ 0x100, 0x01, 0x00, 0x102, 0x101 };
+
+			auto encoded = enc.lzw_encode(in, 8);
+
+			Assert::IsTrue(std::holds_alternative<std::vector<std::bitset<9>>>(encoded));
+			Assert::IsTrue(std::get<std::vector<std::bitset<9>>>(encoded) == expected);
+		}
+
+		//Enough distinct strings to fill the dictionary several times over
+		static auto noiseIndices(size_t const count) -> std::vector<byte> {
+			std::vector<byte> in(count);
+			uint32_t state = 1;
+			for (auto& b : in) {
+				state = state * 1103515245 + 12345;
+				b = byte((state >> 16) & 0xff);
+			}
+			return in;
+		}
+
+		TEST_METHOD(TestLZWCapsAt12Bits)
+		{
+			gif::encoder enc;
+
+			auto encoded = enc.lzw_encode(noiseIndices(100000), 8);
+
+			Assert::IsTrue(std::holds_alternative<std::vector<std::bitset<12>>>(encoded));
+		}
+
+		TEST_METHOD(TestLZWDictionaryPolicies)
+		{
+			gif::encoder enc;
+			auto const in = noiseIndices(100000);
+			auto const clearCode = std::bitset<12>(0x100);
+
+			auto cleared = std::get<std::vector<std::bitset<12>>>(enc.lzw_encode(in, 8, gif::dictionaryPolicy::clear));
+			auto deferred = std::get<std::vector<std::bitset<12>>>(enc.lzw_encode(in, 8, gif::dictionaryPolicy::deferred));
+
+			Assert::IsTrue(std::count(cleared.begin(), cleared.end(), clearCode) > 1);
+			Assert::IsTrue(std::count(deferred.begin(), deferred.end(), clearCode) == 1);
+		}
+
+		TEST_METHOD(TestLZWSingleStrip)
+		{
+			gif::encoder enc;
+			auto const in = noiseIndices(20000);
+
+			Assert::IsTrue(enc.lzw_compress_strips(in, 8, 100, 1) == enc.lzw_compress(in, 8));
+		}
+
+		TEST_METHOD(TestLZWStripsParallel)
+		{
+			gif::encoder enc;
+			auto const in = noiseIndices(20000);
+
+			auto const serial = enc.lzw_compress_strips(in, 8, 100, 7, 1);
+			auto const parallel = enc.lzw_compress_strips(in, 8, 100, 7, 4);
+
+			Assert::IsTrue(serial == parallel);
+			Assert::IsFalse(serial == enc.lzw_compress(in, 8));
+		}
+
+		TEST_METHOD(TestLZWDecode)
+		{
+			gif::encoder enc;
+			gif::lzwDecoder lzw;
+			auto const in = noiseIndices(20000);
+			std::vector<byte> out(in.size());
+
+			for (auto const policy : { gif::dictionaryPolicy::clear, gif::dictionaryPolicy::deferred, gif::dictionaryPolicy::adaptive }) {
+				auto const codes = enc.lzw_compress(in, 8, policy);
+				Assert::IsTrue(lzw.decode(codes.data(), codes.size(), 8, out.data(), out.size()) == in.size() && out == in);
+			}
+			auto const joined = enc.lzw_compress_strips(in, 8, 100, 7, 2);
+			Assert::IsTrue(lzw.decode(joined.data(), joined.size(), 8, out.data(), out.size()) == in.size() && out == in);
+
+			std::vector<byte> const small{ byte(0), byte(1), byte(1), byte(0), byte(0), byte(0), byte(1) };
+			auto const narrow = enc.lzw_compress(small, 2);
+			std::vector<byte> first(3);
+			Assert::IsTrue(lzw.decode(narrow.data(), narrow.size(), 2, first.data(), first.size()) == 3);
+			Assert::IsTrue(std::equal(first.begin(), first.end(), small.begin()));
+
+			//Index 0 and then code 7, one past the next free code 6
+			std::vector<byte> const corrupt{ byte(0x38) };
+			Assert::ExpectException<std::invalid_argument>([&] {
+				lzw.decode(corrupt.data(), corrupt.size(), 2, out.data(), out.size());
+				});
+		}
+
+		//Every level decodes to the same indices, the higher ones in fewer bytes
+		TEST_METHOD(TestLZWCompressionLevels)
+		{
+			gif::lzwDecoder lzw;
+			std::vector<byte> screen(640 * 480);
+			for (size_t i = 0; i < screen.size(); i++) {
+				screen[i] = byte(((i / 640) / 20 + (i % 640) / 40) % 2 ? 7 : (i % 7 == 0 ? 3 : 200));
+			}
+			auto const noise = noiseIndices(100000);
+
+			for (auto const& in : { screen, noise }) {
+				std::vector<size_t> sizes;
+				std::vector<byte> out(in.size());
+				for (auto const level : { gif::compressionLevel::fast, gif::compressionLevel::lookahead, gif::compressionLevel::best }) {
+					gif::encoder enc;
+					enc.setCompressionLevel(level);
+					auto const codes = enc.lzw_compress(in, 8);
+					Assert::IsTrue(lzw.decode(codes.data(), codes.size(), 8, out.data(), out.size()) == in.size() && out == in);
+					sizes.push_back(codes.size());
+				}
+				Assert::IsTrue(sizes[1] <= sizes[0] && sizes[2] <= sizes[1]);
+			}
+
+			//Lookahead pays once the table is full, a fresh table pays on noise
+			gif::encoder enc;
+			auto const greedyScreen = enc.lzw_compress(screen, 8).size();
+			auto const greedyNoise = enc.lzw_compress(noise, 8).size();
+			enc.setCompressionLevel(gif::compressionLevel::best);
+			Assert::IsTrue(enc.lzw_compress(screen, 8).size() < greedyScreen);
+			Assert::IsTrue(enc.lzw_compress(noise, 8).size() < greedyNoise);
+			Assert::IsTrue(enc.lzw_compress(noise, 8).size() <= enc.lzw_compress(noise, 8, gif::dictionaryPolicy::clear).size());
+		}
+
+		TEST_METHOD(TestEncodeStats)
+		{
+			gif::encoder enc;
+			auto const in = noiseIndices(20000);
+			gif::lzwStats cleared, deferred;
+			enc.lzw_compress(in, 8, gif::dictionaryPolicy::clear, {}, &cleared);
+			enc.lzw_compress(in, 8, gif::dictionaryPolicy::deferred, {}, &deferred);
+			Assert::IsTrue(cleared.clearCodes > 1 && cleared.dictionaryFills == cleared.clearCodes - 1);
+			Assert::IsTrue(deferred.clearCodes == 1 && deferred.dictionaryFills == 1);
+
+			std::vector<std::vector<gif::RGBpixel>> frames{ noisePixels(128 * 128, 3), noisePixels(128 * 128, 3), noisePixels(128 * 128, 5) };
+			auto const expected = gif::encoder(128, 128, frames).write().value();
+
+			gif::encodeStats stats;
+			auto measured = gif::encoder(128, 128, frames);
+			measured.setDropDuplicates(true);
+			measured.setStats(&stats);
+			auto const file = measured.write().value();
+			Assert::IsTrue(stats.frames.size() == 2 && stats.frames[0].index == 0 && stats.frames[1].index == 2);
+
+			size_t imageData = 0;
+			size_t clearCodes = 0;
+			for (auto const& frame : stats.frames) {
+				Assert::IsTrue(frame.pixels == 128 * 128 && frame.paletteSize == 256);
+				Assert::IsTrue(frame.lzw.dictionaryFills >= 1 && frame.times[gif::encodeStats::compression].wallMs > 0);
+				imageData += gif::imageDataSize(frame.compressedBytes);
+				clearCodes += frame.lzw.clearCodes;
+			}
+			Assert::IsTrue(imageData < file.size() && stats.lzw.clearCodes == clearCodes);
+			Assert::IsTrue(stats.paletteSize == 256 && stats.peakBufferBytes >= file.size());
+
+			double stages = 0;
+			for (auto const& time : stats.times) {
+				Assert::IsTrue(time.wallMs >= 0 && time.cpuMs >= 0);
+				stages += time.wallMs;
+			}
+			Assert::IsTrue(stages > 0 && stages <= stats.elapsedMs);
+
+			//Stats add up until they are cleared, and never change a byte
+			measured.write();
+			Assert::IsTrue(stats.frames.size() == 4);
+			stats.clear();
+			measured.setStats(nullptr);
+			measured.setDropDuplicates(false);
+			Assert::IsTrue(measured.write().value() == expected && stats.frames.empty());
+
+			std::ostringstream os;
+			auto stream = gif::streamEncoder(128, 128, gif::toStream(os));
+			stream.setStats(&stats);
+			for (auto const& frame : frames) {
+				stream.add_frame(frame);
+			}
+			stream.finish();
+			Assert::IsTrue(stats.frames.size() == 3 && stats.frames[2].index == 2 && stats.frames[2].compressedBytes > 0);
+			Assert::IsTrue(stats.times[gif::encodeStats::quantization].wallMs > 0 && stats.lzw.dictionaryFills >= 3);
+		}
+
 		TEST_METHOD(Pack12)
 		{
 			auto in = std::vector<std::bitset<12>>({ {0xf0f},{0x1e1 } });
@@ -431,5 +1735,73 @@ namespace TestPalette
 			Assert::IsTrue(std::equal(out.first.begin(), out.first.end(), expected.begin(), expected.end()));
 
 		};
+
+		TEST_METHOD(BitWriter7)
+		{
+			auto writer = gif::bitWriter();
+			writer.write(0x1f, 7);
+			writer.write(0x7f, 7);
+
+			auto expected = std::vector<byte>{ byte(0x9f), byte(0x3f) };
+			auto out = writer.finish();
+
+			Assert::IsTrue(std::equal(out.begin(), out.end(), expected.begin(), expected.end()));
+		};
+
+		//Crosses the 32 bit flush of the accumulator
+		TEST_METHOD(BitWriter12)
+		{
+			auto writer = gif::bitWriter();
+			writer.write(0xf0f, 12);
+			writer.write(0x1e1, 12);
+			writer.write(0xabc, 12);
+
+			auto expected = std::vector<byte>{ byte(0x0f), byte(0x1f), byte(0x1e), byte(0xbc), byte(0x0a) };
+			auto out = writer.finish();
+
+			Assert::IsTrue(std::equal(out.begin(), out.end(), expected.begin(), expected.end()));
+		};
+
+		TEST_METHOD(BitWriterMixedWidth)
+		{
+			auto writer = gif::bitWriter();
+			writer.write(0x4, 3);
+			writer.write(0xa, 4);
+
+			auto expected = std::vector<byte>{ byte(0x54) };
+			auto out = writer.finish();
+
+			Assert::IsTrue(std::equal(out.begin(), out.end(), expected.begin(), expected.end()));
+		};
+
+		//All codes stay 9 bits wide here so the streaming path has to match the packed one
+		TEST_METHOD(TestLZWCompressWiki)
+		{
+			gif::encoder enc;
+
+			auto expected = std::vector<byte>{ byte(0x00), byte(0x51), byte(0xFC), byte(0x1B), byte(0x28), byte(0x70), byte(0xA0), byte(0xC1), byte(0x83), byte(0x01),byte(0x01) };
+			auto in = std::vector<byte>{ byte(0x28), byte(0xff), byte(0xff), byte(0xff), byte(0x28), byte(0xff), byte(0xff), byte(0xff), byte(0xff), byte(0xff), byte(0xff), byte(0xff), byte(0xff), byte(0xff), byte(0xff), };
+
+			auto out = enc.lzw_compress(in, 8);
+
+			Assert::IsTrue(std::equal(out.begin(), out.end(), expected.begin(), expected.end()));
+		}
+
+		//Codes start at 3 bits and widen to 4 once code 8 is handed out
+		TEST_METHOD(TestLZWCompressGrowingWidth)
+		{
+			gif::encoder enc;
+
+			auto expected = std::vector<byte>{ byte(0x44), byte(0x34), byte(0x86), byte(0x3A), byte(0x05) };
+			auto in = std::vector<byte>{
+				byte(0), byte(1), byte(2), byte(3),
+				byte(0), byte(1), byte(2), byte(3),
+				byte(0), byte(1), byte(2), byte(3)
+			};
+
+			auto out = enc.lzw_compress(in, 2);
+
+			Assert::IsTrue(std::equal(out.begin(), out.end(), expected.begin(), expected.end()));
+		}
 	};
 }
@@ -3,18 +3,170 @@
 #include <algorithm>
 #include <numeric>
 #include <optional>
-#include <map>
 #include <bitset>
 #include <cstddef>
 #include <variant>
+#include <tuple>
+#include <array>
+#include <iterator>
+#include <stdexcept>
+#include <climits>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <cstring>
+#include <memory>
+#include <chrono>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define GIF_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+//Lets GCC and Clang compile a single function for a newer instruction set, MSVC doesn't need it
+#if defined(__GNUC__)
+#define GIF_TARGET(isa) __attribute__((target(isa)))
+#else
+#define GIF_TARGET(isa)
+#endif
+
+//Define to 1 before including to have encoders fill in an encodeStats, at 0 every measurement compiles away
+#ifndef GIF_STATS
+#define GIF_STATS 0
+#endif
+
+#if GIF_STATS
+#if defined(_WIN32)
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#define GIF_DEFINED_NOMINMAX
+#endif
+#include <windows.h>
+#if defined(GIF_DEFINED_NOMINMAX)
+#undef NOMINMAX
+#undef GIF_DEFINED_NOMINMAX
+#endif
+#else
+#include <time.h>
+#endif
+#endif
 
 using std::byte;
 
 //https://www.w3.org/Graphics/GIF/spec-gif89a.txt implementation
 namespace gif {
+	//Serializes into memory the caller owns and sized beforehand, so writing never allocates.
+	//Running past the end throws instead of growing anything.
+	class byteWriter {
+	private:
+		byte* data = nullptr;
+		size_t capacity = 0;
+		size_t used = 0;
+
+		void room(size_t const size) const {
+			if (capacity - used < size)
+				throw std::length_error("Output buffer too small");
+		}
+
+	public:
+		byteWriter(byte* data, size_t capacity) : data(data), capacity(capacity) {}
+
+		void put(byte const b) {
+			room(1);
+			data[used++] = b;
+		}
+
+		//Little endian like every number in the file
+		void put16(uint16_t const v) {
+			room(2);
+			data[used++] = byte(v & 0xff);
+			data[used++] = byte((v >> 8) & 0xff);
+		}
+
+		void put(byte const* bytes, size_t const size) {
+			room(size);
+			if (size != 0)
+				std::memcpy(data + used, bytes, size);
+			used += size;
+		}
+
+		auto size() const -> size_t {
+			return used;
+		}
+	};
+
+	//Reads from memory the caller owns, running past the end throws instead of reading whatever follows
+	class byteReader {
+	private:
+		byte const* data = nullptr;
+		size_t capacity = 0;
+		size_t used = 0;
+
+		void need(size_t const size) const {
+			if (capacity - used < size)
+				throw std::out_of_range("Unexpected end of GIF data");
+		}
+
+	public:
+		byteReader(byte const* data, size_t capacity) : data(data), capacity(capacity) {}
+
+		auto get() -> uint8_t {
+			need(1);
+			return uint8_t(data[used++]);
+		}
+
+		//Little endian like every number in the file
+		auto get16() -> uint16_t {
+			need(2);
+			auto const v = uint16_t(uint8_t(data[used]) | (uint8_t(data[used + 1]) << 8));
+			used += 2;
+			return v;
+		}
+
+		//The next size bytes, left where they are in the caller's memory
+		auto take(size_t const size) -> byte const* {
+			need(size);
+			auto const* const at = data + used;
+			used += size;
+			return at;
+		}
+
+		auto remaining() const -> size_t {
+			return capacity - used;
+		}
+
+		//Where the next read starts
+		auto at() const -> byte const* {
+			return data + used;
+		}
+	};
+
+	//Grows out by size bytes and hands back a writer for them. Any contiguous byte container works,
+	//std::pmr::vector included, and one that already has the capacity doesn't allocate.
+	template<typename Buffer>
+	auto appendTo(Buffer& out, size_t const size) -> byteWriter {
+		auto const at = out.size();
+		out.resize(at + size);
+		return byteWriter(out.data() + at, size);
+	}
+
 	class header {
 	public:
 		std::vector<byte> const  signature = { byte('G'),byte('I'),byte('F'),byte('8'),byte('9'),byte('a') };
+
+		static constexpr size_t size = 6;
+
+		void write(byteWriter& out) const {
+			out.put(signature.data(), signature.size());
+		}
 	};
 
 	class screenDescriptor {
@@ -36,13 +188,32 @@ namespace gif {
 			return hasGCT;
 		}
 
-		auto write() -> std::vector<byte> {
-			std::vector<byte>out(7); //Fixed size required by spec
-			out[0] = byte(((width >> 0) & 0xff));
-			out[1] = byte(((width >> 8) & 0xff));
+		//Like imageDescriptor::setLocalColor, the size field holds one less than the bits per index
+		void setGlobalColor(size_t const tableBits) {
+			hasGCT = true;
+			GCTsize = tableBits - 1;
+		}
+
+		void setBackground(uint8_t const index) {
+			backgroundColorIndex = byte(index);
+		}
+
+		auto dimensions() const -> std::pair<uint16_t, uint16_t> {
+			return { width, height };
+		}
+
+		static constexpr size_t size = 7; //Fixed size required by spec
 
-			out[2] = byte(((height >> 0) & 0xff));
-			out[3] = byte(((height >> 8) & 0xff));
+		auto write() const -> std::vector<byte> {
+			std::vector<byte> out;
+			auto writer = appendTo(out, size);
+			write(writer);
+			return out;
+		}
+
+		void write(byteWriter& out) const {
+			out.put16(width);
+			out.put16(height);
 
 			std::bitset<8> bitfield;
 			bitfield.set(7, hasGCT);
@@ -57,12 +228,10 @@ namespace gif {
 			bitfield.set(1, GCTsize[1]);
 			bitfield.set(0, GCTsize[0]);
 
-			out[4] = byte(bitfield.to_ulong());
-
-			out[5] = backgroundColorIndex;
-			out[6] = pixelAspectRatio;
+			out.put(byte(bitfield.to_ulong()));
 
-			return out;
+			out.put(backgroundColorIndex);
+			out.put(pixelAspectRatio);
 		}
 	};
 
@@ -104,6 +273,18 @@ namespace gif {
 		std::vector<RGBpixel> const table;
 		colorTable(std::vector<RGBpixel> const& t) : table(t) {}
 
+		auto size() const -> size_t {
+			return table.size() * 3;
+		}
+
+		void write(byteWriter& out) const {
+			for (auto const& p : table) {
+				out.put(byte(p.r));
+				out.put(byte(p.g));
+				out.put(byte(p.b));
+			}
+		}
+
 		auto bitsNeeded() -> size_t {
 			for (int i = sizeof(size_t) * 8; i > 2; i--) {
 				if ((table.size() >> i) == 1) {
@@ -114,6 +295,15 @@ namespace gif {
 		}
 	};
 
+	//A caller's palette filled up to the 256 entries the screen descriptor announces. The filler repeats the last
+	//color instead of adding black, and only the caller's own entries are ever mapped to.
+	auto fillPalette(std::vector<RGBpixel> table) -> std::vector<RGBpixel> {
+		if (table.empty())
+			throw std::invalid_argument("Palette must have 1 to 256 entries");
+		table.resize(256, table.back());
+		return table;
+	}
+
 	class applicationExtensionLoop {
 	private:
 		byte extensionLabel = byte(0x21);
@@ -130,25 +320,124 @@ namespace gif {
 		byte blockTerminator = byte(0x0);
 
 	public:
-		auto write() -> std::vector<byte> {
+		//How often the animation plays after the first time, 0 is forever
+		applicationExtensionLoop(uint16_t const loops = 0) : loopCount(loops) {}
+
+		static constexpr size_t size = 19;
+
+		auto write() const -> std::vector<byte> {
 			std::vector<byte> out;
+			auto writer = appendTo(out, size);
+			write(writer);
+			return out;
+		}
+
+		void write(byteWriter& out) const {
+			out.put(extensionLabel);
+			out.put(appExtensionLabel);
+			out.put(blockSize);
+
+			out.put(appIdentifier.data(), appIdentifier.size());
+			out.put(appAuthentication.data(), appAuthentication.size());
+
+			out.put(subBlockDataSize);
+			out.put(subBlockID);
+			out.put16(loopCount);
+			out.put(blockTerminator);
+		}
+	};
+
+	//What the decoder does with a frame once its delay is over
+	enum class disposal : uint8_t {
+		unspecified = 0,
+		keep = 1, //Leave it for the next frame to draw over
+		background = 2,
+		previous = 3,
+	};
+
+	class graphicControlExtension {
+	private:
+		byte extensionLabel = byte(0x21);
+		byte controlLabel = byte(0xf9);
+		byte blockSize = byte(0x04);
+		disposal dispose = disposal::keep;
+		bool userInput = false;
+		std::optional<uint8_t> transparentIndex;
+		uint16_t delay = 0; //hundredths of a second
+		byte blockTerminator = byte(0x0);
+
+	public:
+		graphicControlExtension(uint16_t hundredths = 0, disposal method = disposal::keep) : dispose(method), delay(hundredths) {}
+
+		void setDelay(uint16_t const hundredths) {
+			delay = hundredths;
+		}
+
+		auto getDelay() const -> uint16_t {
+			return delay;
+		}
 
-			out.emplace_back(extensionLabel);
-			out.emplace_back(appExtensionLabel);
-			out.emplace_back(blockSize);
+		void setTransparent(std::optional<uint8_t> const index) {
+			transparentIndex = index;
+		}
 
-			std::copy(appIdentifier.begin(), appIdentifier.end(), std::back_inserter(out));
-			std::copy(appAuthentication.begin(), appAuthentication.end(), std::back_inserter(out));
+		static constexpr size_t size = 8;
 
-			out.emplace_back(subBlockDataSize);
-			out.emplace_back(subBlockID);
-			out.emplace_back(byte((loopCount >> 0) & 0xff));
-			out.emplace_back(byte((loopCount >> 8) & 0xff));
-			out.emplace_back(blockTerminator);
+		auto write() const -> std::vector<byte> {
+			std::vector<byte> out;
+			auto writer = appendTo(out, size);
+			write(writer);
 			return out;
 		}
+
+		void write(byteWriter& out) const {
+			out.put(extensionLabel);
+			out.put(controlLabel);
+			out.put(blockSize);
+
+			std::bitset<8> bitfield = uint8_t(dispose) << 2;
+			bitfield[1] = userInput;
+			bitfield[0] = transparentIndex.has_value();
+			out.put(byte(bitfield.to_ulong()));
+
+			out.put16(delay);
+			out.put(byte(transparentIndex.value_or(0)));
+			out.put(blockTerminator);
+		}
+	};
+
+	//Part of the screen an image covers
+	struct region {
+		uint16_t left = 0;
+		uint16_t top = 0;
+		uint16_t width = 0;
+		uint16_t height = 0;
 	};
 
+	//Part both cover, empty when they don't touch
+	auto intersection(region const& lhs, region const& rhs) -> region {
+		auto const left = std::max(lhs.left, rhs.left);
+		auto const top = std::max(lhs.top, rhs.top);
+		auto const right = std::min(size_t(lhs.left) + lhs.width, size_t(rhs.left) + rhs.width);
+		auto const bottom = std::min(size_t(lhs.top) + lhs.height, size_t(rhs.top) + rhs.height);
+		if (right <= left || bottom <= top)
+			return region{};
+		return region{ left, top, uint16_t(right - left), uint16_t(bottom - top) };
+	}
+
+	//Smallest region covering both, an empty one doesn't count
+	auto boundingBox(region const& lhs, region const& rhs) -> region {
+		if (lhs.width == 0 || lhs.height == 0)
+			return rhs;
+		if (rhs.width == 0 || rhs.height == 0)
+			return lhs;
+		auto const left = std::min(lhs.left, rhs.left);
+		auto const top = std::min(lhs.top, rhs.top);
+		auto const right = std::max(size_t(lhs.left) + lhs.width, size_t(rhs.left) + rhs.width);
+		auto const bottom = std::max(size_t(lhs.top) + lhs.height, size_t(rhs.top) + rhs.height);
+		return region{ left, top, uint16_t(right - left), uint16_t(bottom - top) };
+	}
+
 	class imageDescriptor {
 	private:
 		std::byte const seperator = std::byte{ 0x2c };
@@ -165,21 +454,47 @@ namespace gif {
 	public:
 		imageDescriptor(uint16_t width, uint16_t height, bool hasLocalColor = false) :width(width), height(height), hasLocalColor(hasLocalColor) {}
 
-		auto write() const -> std::vector<byte> {
-			std::vector<byte> out(10);
-			out[0] = seperator;
+		auto dimensions() const -> std::pair<uint16_t, uint16_t> {
+			return { width, height };
+		}
 
-			out[1] = byte(((left >> 0) & 0xff));
-			out[2] = byte(((left >> 8) & 0xff));
+		auto area() const -> region {
+			return region{ left, top, width, height };
+		}
+
+		void setRegion(region const& area) {
+			left = area.left;
+			top = area.top;
+			width = area.width;
+			height = area.height;
+		}
+
+		//The size field holds one less than the bits per index, the table itself follows the descriptor
+		void setLocalColor(size_t const tableBits) {
+			hasLocalColor = true;
+			localColorSize = tableBits - 1;
+		}
+
+		//Rows are stored in four passes, see decoder::decode
+		void setInterlaced(bool const interlaced) {
+			isInterlaced = interlaced;
+		}
 
-			out[3] = byte(((top >> 0) & 0xff));
-			out[4] = byte(((top >> 8) & 0xff));
+		static constexpr size_t size = 10;
 
-			out[5] = byte(((width >> 0) & 0xff));
-			out[6] = byte(((width >> 8) & 0xff));
+		auto write() const -> std::vector<byte> {
+			std::vector<byte> out;
+			auto writer = appendTo(out, size);
+			write(writer);
+			return out;
+		}
 
-			out[7] = byte(((height >> 0) & 0xff));
-			out[8] = byte(((height >> 8) & 0xff));
+		void write(byteWriter& out) const {
+			out.put(seperator);
+			out.put16(left);
+			out.put16(top);
+			out.put16(width);
+			out.put16(height);
 
 			std::bitset<8> bitfield;
 
@@ -194,9 +509,7 @@ namespace gif {
 			bitfield[1] = localColorSize[1];
 			bitfield[0] = localColorSize[0];
 
-			out[9] = byte(bitfield.to_ulong());
-
-			return out;
+			out.put(byte(bitfield.to_ulong()));
 		}
 	};
 
@@ -205,392 +518,3636 @@ namespace gif {
 		std::byte const trail = std::byte{ 0x3b };
 	};
 
-	auto median_cut(std::vector<RGBpixel> const& pixels) -> std::pair<std::vector<RGBpixel>, std::vector<RGBpixel>> {
-		if (pixels.size() == 0) {
-			return {};
-		}
+	enum class simdLevel {
+		scalar,
+		sse41,
+		avx2,
+	};
 
-		auto bucket = pixels;
-		auto Rplane = std::vector<uint8_t>(bucket.size());
-		auto Gplane = std::vector<uint8_t>(bucket.size());
-		auto Bplane = std::vector<uint8_t>(bucket.size());
+	//Best instruction set both the CPU and the OS support, checked once
+	auto detectSimd() -> simdLevel {
+		static simdLevel const level = [] {
+#if defined(GIF_X86) && defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 0);
+			auto const maxLeaf = info[0];
+			__cpuid(info, 1);
+			bool const sse41 = (info[2] & (1 << 19)) != 0;
+			bool const osAVX = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+			bool avx2 = false;
+			if (maxLeaf >= 7 && osAVX) {
+				__cpuidex(info, 7, 0);
+				avx2 = (info[1] & (1 << 5)) != 0;
+			}
+#elif defined(GIF_X86)
+			__builtin_cpu_init();
+			bool const sse41 = __builtin_cpu_supports("sse4.1");
+			bool const avx2 = __builtin_cpu_supports("avx2");
+#else
+			bool const sse41 = false;
+			bool const avx2 = false;
+#endif
+			return avx2 ? simdLevel::avx2 : (sse41 ? simdLevel::sse41 : simdLevel::scalar);
+		}();
+		return level;
+	}
 
-		for (size_t i = 0; i < pixels.size(); i++) {
-			Rplane[i] = bucket[i].r;
-			Gplane[i] = bucket[i].g;
-			Bplane[i] = bucket[i].b;
-		}
-		auto const Rbounds = std::minmax_element(Rplane.begin(), Rplane.end());
-		auto const Gbounds = std::minmax_element(Gplane.begin(), Gplane.end());
-		auto const Bbounds = std::minmax_element(Bplane.begin(), Bplane.end());
+	//Byte layouts pixelView reads, alpha is skipped
+	enum class pixelFormat {
+		rgb24,
+		rgba32,
+		bgra32,
+	};
 
-		auto const Rrange = *Rbounds.second - *Rbounds.first;
-		auto const Grange = *Gbounds.second - *Gbounds.first;
-		auto const Brange = *Bbounds.second - *Bbounds.first;
+	//Moves pixels between the pixelFormat layouts and planes of red, green and blue with byte shuffles,
+	//SSSE3 at the sse41 level (every SSE4.1 CPU has it) and AVX2 above that. Alpha passes through between
+	//the 4 byte layouts and comes out opaque from everything else.
+	class pixelConverter {
+	private:
+		pixelFormat from = pixelFormat::rgb24;
+		pixelFormat to = pixelFormat::rgb24;
+		simdLevel level = simdLevel::scalar;
 
-		auto const ranges = std::vector{ Rrange, Grange, Brange };
+		//Shuffles for 16 bytes at a time, 0x80 leaves a zero. Converts 4 source pixels to the target layout,
+		//gathers 4 source pixels as rrrr gggg bbbb, and turns 4 RGBA pixels into the target layout.
+		alignas(16) uint8_t convertMask[16];
+		alignas(16) uint8_t planeMask[16];
+		alignas(16) uint8_t storeMask[16];
 
-		auto const max = std::max_element(ranges.begin(), ranges.end());
+		static auto bytes(pixelFormat const format) -> size_t {
+			return format == pixelFormat::rgb24 ? 3 : 4;
+		}
 
-		auto const greatest = std::clamp(std::distance(ranges.begin(), max), ptrdiff_t(0), ptrdiff_t(2));
-		std::sort(bucket.begin(), bucket.end(), [greatest](RGBpixel& i, RGBpixel& j) -> bool {
-			switch (greatest) {
-			case 0:
-				return i.r < j.r;
-			case 1:
-				return i.g < j.g;
-			case 2:
-				return i.b < j.b;
-			default:
-				return false; //Earth has exploded if we hit this
+		//Offsets of red, green and blue inside a pixel
+		static auto offsets(pixelFormat const format) -> std::array<size_t, 3> {
+			return format == pixelFormat::bgra32 ? std::array<size_t, 3>{ 2, 1, 0 } : std::array<size_t, 3>{ 0, 1, 2 };
+		}
+
+		void convertScalar(uint8_t const* in, uint8_t* out, size_t const count) const {
+			auto const inStep = bytes(from);
+			auto const outStep = bytes(to);
+			auto const src = offsets(from);
+			auto const dst = offsets(to);
+			for (size_t i = 0; i < count; i++, in += inStep, out += outStep) {
+				out[dst[0]] = in[src[0]];
+				out[dst[1]] = in[src[1]];
+				out[dst[2]] = in[src[2]];
+				if (outStep == 4)
+					out[3] = inStep == 4 ? in[3] : 255;
 			}
-			});
+		}
 
-		auto lower = std::vector<RGBpixel>(bucket.begin(), bucket.begin() + (bucket.size() / 2));
-		auto upper = std::vector<RGBpixel>(bucket.begin() + (bucket.size() / 2), bucket.end());
-		return std::pair{ lower,upper };
-	}
+		void splitScalar(uint8_t const* in, size_t const count, uint8_t* r, uint8_t* g, uint8_t* b) const {
+			auto const step = bytes(from);
+			auto const src = offsets(from);
+			for (size_t i = 0; i < count; i++, in += step) {
+				r[i] = in[src[0]];
+				g[i] = in[src[1]];
+				b[i] = in[src[2]];
+			}
+		}
 
-	auto average(std::vector<RGBpixel> const& pixels) -> RGBpixel {
-		RGBpixel32 sum;
-		for (auto const& p : pixels) {
-			sum = sum + p;
+		void joinScalar(uint8_t const* r, uint8_t const* g, uint8_t const* b, size_t const count, uint8_t* out) const {
+			auto const step = bytes(to);
+			auto const dst = offsets(to);
+			for (size_t i = 0; i < count; i++, out += step) {
+				out[dst[0]] = r[i];
+				out[dst[1]] = g[i];
+				out[dst[2]] = b[i];
+				if (step == 4)
+					out[3] = 255;
+			}
 		}
 
-		return RGBpixel{ uint8_t(sum.r / pixels.size()),uint8_t(sum.g / pixels.size()),uint8_t(sum.b / pixels.size()) };
-	}
+#if defined(GIF_X86)
+		//The kernels return how many pixels they did, the scalar loop does the rest. Loads never reach
+		//past the last pixel, which is why the RGB24 loops stop a few pixels early.
 
-	auto palletize(std::vector<RGBpixel> const& pixels, int bitDepth = 256) -> std::vector<RGBpixel> {
-		if (bitDepth == 1) {
-			if (pixels.size() != 0)
-				return std::vector{ average(pixels) };
-			else
-				return { RGBpixel() };
+		//4 vectors with RGB24 in their low 12 bytes, written out as 48 packed bytes
+		GIF_TARGET("sse4.1")
+		static void storePacked(__m128i const a, __m128i const b, __m128i const c, __m128i const d, uint8_t* out) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_or_si128(a, _mm_slli_si128(b, 12)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 32), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
 		}
-		auto res = median_cut(pixels);
-		auto lhs = palletize(res.first, bitDepth / 2);
-		auto rhs = palletize(res.second, bitDepth / 2);
-		lhs.insert(lhs.end(), rhs.begin(), rhs.end());
-		return lhs;
-	}
 
-	using lzw_code = std::variant<
-		std::vector<std::bitset<2>>,
-		std::vector<std::bitset<3>>,
-		std::vector<std::bitset<4>>,
-		std::vector<std::bitset<5>>,
-		std::vector<std::bitset<6>>,
-		std::vector<std::bitset<7>>,
-		std::vector<std::bitset<8>>,
-		std::vector<std::bitset<9>>,
-		std::vector<std::bitset<10>>,
-		std::vector<std::bitset<11>>,
-		std::vector<std::bitset<12>>,
-		std::vector<std::bitset<13>>,
-		std::vector<std::bitset<14>>
-	>;
+		GIF_TARGET("sse4.1")
+		auto convertSSSE3(uint8_t const* in, uint8_t* out, size_t const count) const -> size_t {
+			auto const mask = _mm_load_si128(reinterpret_cast<__m128i const*>(convertMask));
+			auto const inStep = bytes(from);
+			size_t i = 0;
+			if (bytes(to) == 4) {
+				auto const alpha = inStep == 3 ? _mm_set1_epi32(int32_t(0xFF000000u)) : _mm_setzero_si128();
+				for (; i + (inStep == 3 ? 6 : 4) <= count; i += 4) {
+					auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(in + i * inStep));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 4), _mm_or_si128(_mm_shuffle_epi8(v, mask), alpha));
+				}
+				return i;
+			}
+			if (inStep == 3)
+				return 0;
+			for (; i + 16 <= count; i += 16) {
+				auto const* p = reinterpret_cast<__m128i const*>(in + i * 4);
+				storePacked(_mm_shuffle_epi8(_mm_loadu_si128(p), mask), _mm_shuffle_epi8(_mm_loadu_si128(p + 1), mask),
+					_mm_shuffle_epi8(_mm_loadu_si128(p + 2), mask), _mm_shuffle_epi8(_mm_loadu_si128(p + 3), mask), out + i * 3);
+			}
+			return i;
+		}
 
-	template<std::size_t const n>
-	auto toBitset(std::vector<uint16_t> const& in) -> lzw_code {
-		auto buffer = std::vector<std::bitset<n>>(in.size());
-		for (size_t i = 0; i < buffer.size(); i++) {
-			buffer[i] = in[i];
+		//Gathers 16 pixels per channel and then transposes 4x4 blocks of 4 bytes
+		GIF_TARGET("sse4.1")
+		auto splitSSSE3(uint8_t const* in, size_t const count, uint8_t* r, uint8_t* g, uint8_t* b) const -> size_t {
+			auto const mask = _mm_load_si128(reinterpret_cast<__m128i const*>(planeMask));
+			auto const step = bytes(from);
+			size_t i = 0;
+			for (; i + (step == 3 ? 18 : 16) <= count; i += 16) {
+				__m128i v[4];
+				for (size_t k = 0; k < 4; k++) {
+					v[k] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(in + (i + 4 * k) * step)), mask);
+				}
+				auto const t0 = _mm_unpacklo_epi32(v[0], v[1]);
+				auto const t1 = _mm_unpackhi_epi32(v[0], v[1]);
+				auto const t2 = _mm_unpacklo_epi32(v[2], v[3]);
+				auto const t3 = _mm_unpackhi_epi32(v[2], v[3]);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(r + i), _mm_unpacklo_epi64(t0, t2));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(g + i), _mm_unpackhi_epi64(t0, t2));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(b + i), _mm_unpacklo_epi64(t1, t3));
+			}
+			return i;
 		}
-		return buffer;
-	}
 
-	auto mapPixels(std::vector<RGBpixel> const& p, colorTable const& m) -> std::vector<byte> {
-		auto distance = [](RGBpixel const& lhs, RGBpixel const& rhs) -> auto {
-			return ((rhs.r - lhs.r) * (rhs.r - lhs.r)) +
-				((rhs.g - lhs.g) * (rhs.g - lhs.g)) +
-				((rhs.b - lhs.b) * (rhs.b - lhs.b));
-		};
+		//Interleaves to RGBA first, then shuffles that into the target layout
+		GIF_TARGET("sse4.1")
+		auto joinSSSE3(uint8_t const* r, uint8_t const* g, uint8_t const* b, size_t const count, uint8_t* out) const -> size_t {
+			auto const mask = _mm_load_si128(reinterpret_cast<__m128i const*>(storeMask));
+			auto const alpha = _mm_set1_epi8(-1);
+			auto const step = bytes(to);
+			size_t i = 0;
+			for (; i + 16 <= count; i += 16) {
+				auto const red = _mm_loadu_si128(reinterpret_cast<__m128i const*>(r + i));
+				auto const green = _mm_loadu_si128(reinterpret_cast<__m128i const*>(g + i));
+				auto const blue = _mm_loadu_si128(reinterpret_cast<__m128i const*>(b + i));
+				auto const rgLow = _mm_unpacklo_epi8(red, green);
+				auto const rgHigh = _mm_unpackhi_epi8(red, green);
+				auto const baLow = _mm_unpacklo_epi8(blue, alpha);
+				auto const baHigh = _mm_unpackhi_epi8(blue, alpha);
+				__m128i const rgba[4] = {
+					_mm_shuffle_epi8(_mm_unpacklo_epi16(rgLow, baLow), mask),
+					_mm_shuffle_epi8(_mm_unpackhi_epi16(rgLow, baLow), mask),
+					_mm_shuffle_epi8(_mm_unpacklo_epi16(rgHigh, baHigh), mask),
+					_mm_shuffle_epi8(_mm_unpackhi_epi16(rgHigh, baHigh), mask) };
+				if (step == 3) {
+					storePacked(rgba[0], rgba[1], rgba[2], rgba[3], out + i * 3);
+					continue;
+				}
+				for (size_t k = 0; k < 4; k++) {
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + (i + 4 * k) * 4), rgba[k]);
+				}
+			}
+			return i;
+		}
 
-		std::vector<byte> out(p.size());
+		//8 pixels with 12 bytes of RGB24 at the bottom of each lane, written out as 24 packed bytes
+		GIF_TARGET("avx2")
+		static void storePacked(__m256i const v, uint8_t* out) {
+			auto const packed = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(packed));
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out + 16), _mm256_extracti128_si256(packed, 1));
+		}
 
-		for (size_t i = 0; i < p.size(); i++) {
-			int smallest = INT_MAX;
-			size_t pos = 0;
+		//8 RGB24 pixels, 4 in each lane
+		GIF_TARGET("avx2")
+		static auto loadRGB24(uint8_t const* in) -> __m256i {
+			return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<__m128i const*>(in))),
+				_mm_loadu_si128(reinterpret_cast<__m128i const*>(in + 12)), 1);
+		}
 
-			for (size_t j = 0; j < m.table.size(); j++) {
-				if (auto d = distance(p[i], m.table[j]); d < smallest) {
-					smallest = d;
-					pos = j;
+		GIF_TARGET("avx2")
+		auto convertAVX2(uint8_t const* in, uint8_t* out, size_t const count) const -> size_t {
+			auto const mask = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<__m128i const*>(convertMask)));
+			auto const inStep = bytes(from);
+			size_t i = 0;
+			if (bytes(to) == 4) {
+				auto const alpha = inStep == 3 ? _mm256_set1_epi32(int32_t(0xFF000000u)) : _mm256_setzero_si256();
+				for (; i + (inStep == 3 ? 10 : 8) <= count; i += 8) {
+					auto const v = inStep == 3 ? loadRGB24(in + i * 3) : _mm256_loadu_si256(reinterpret_cast<__m256i const*>(in + i * 4));
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(v, mask), alpha));
 				}
+				return i;
+			}
+			if (inStep == 3)
+				return 0;
+			for (; i + 8 <= count; i += 8) {
+				storePacked(_mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(in + i * 4)), mask), out + i * 3);
 			}
-			out[i] = std::byte(pos);
+			return i;
 		}
-		return out;
-	}
 
+		//Same transpose as splitSSSE3 inside each lane, the lanes hold every other group of 4 pixels until the final permute
+		GIF_TARGET("avx2")
+		auto splitAVX2(uint8_t const* in, size_t const count, uint8_t* r, uint8_t* g, uint8_t* b) const -> size_t {
+			auto const mask = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<__m128i const*>(planeMask)));
+			auto const order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+			auto const step = bytes(from);
+			size_t i = 0;
+			for (; i + (step == 3 ? 34 : 32) <= count; i += 32) {
+				__m256i v[4];
+				for (size_t k = 0; k < 4; k++) {
+					auto const* p = in + (i + 8 * k) * step;
+					v[k] = _mm256_shuffle_epi8(step == 3 ? loadRGB24(p) : _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p)), mask);
+				}
+				auto const t0 = _mm256_unpacklo_epi32(v[0], v[1]);
+				auto const t1 = _mm256_unpackhi_epi32(v[0], v[1]);
+				auto const t2 = _mm256_unpacklo_epi32(v[2], v[3]);
+				auto const t3 = _mm256_unpackhi_epi32(v[2], v[3]);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(r + i), _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi64(t0, t2), order));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(g + i), _mm256_permutevar8x32_epi32(_mm256_unpackhi_epi64(t0, t2), order));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(b + i), _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi64(t1, t3), order));
+			}
+			return i;
+		}
 
-	class encoder {
-	private:
-		header signature;
-		screenDescriptor screen;
-		std::optional<colorTable> GCT;
-		std::optional<applicationExtensionLoop> loop;
-		std::vector<std::tuple<
-			imageDescriptor,
-			std::optional<colorTable>,
-			std::vector<RGBpixel>>
-			>descriptors;
+		GIF_TARGET("avx2")
+		auto joinAVX2(uint8_t const* r, uint8_t const* g, uint8_t const* b, size_t const count, uint8_t* out) const -> size_t {
+			auto const mask = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<__m128i const*>(storeMask)));
+			auto const alpha = _mm256_set1_epi8(-1);
+			auto const step = bytes(to);
+			size_t i = 0;
+			for (; i + 32 <= count; i += 32) {
+				auto const red = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(r + i));
+				auto const green = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(g + i));
+				auto const blue = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(b + i));
 
-		trailer end;
+				//Unpacking stays inside the lanes, the low lane ends up with pixels 0-15 and the high one with 16-31
+				auto const rgLow = _mm256_unpacklo_epi8(red, green);
+				auto const rgHigh = _mm256_unpackhi_epi8(red, green);
+				auto const baLow = _mm256_unpacklo_epi8(blue, alpha);
+				auto const baHigh = _mm256_unpackhi_epi8(blue, alpha);
+				auto const q0 = _mm256_unpacklo_epi16(rgLow, baLow);
+				auto const q1 = _mm256_unpackhi_epi16(rgLow, baLow);
+				auto const q2 = _mm256_unpacklo_epi16(rgHigh, baHigh);
+				auto const q3 = _mm256_unpackhi_epi16(rgHigh, baHigh);
+				__m256i const rgba[4] = {
+					_mm256_shuffle_epi8(_mm256_permute2x128_si256(q0, q1, 0x20), mask),
+					_mm256_shuffle_epi8(_mm256_permute2x128_si256(q2, q3, 0x20), mask),
+					_mm256_shuffle_epi8(_mm256_permute2x128_si256(q0, q1, 0x31), mask),
+					_mm256_shuffle_epi8(_mm256_permute2x128_si256(q2, q3, 0x31), mask) };
+				for (size_t k = 0; k < 4; k++) {
+					if (step == 3)
+						storePacked(rgba[k], out + (i + 8 * k) * 3);
+					else
+						_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + (i + 8 * k) * 4), rgba[k]);
+				}
+			}
+			return i;
+		}
+#endif
 
 	public:
-		//TODO: imagedescriptor, image data, support for multiple images in constructor
-		encoder(uint16_t width, uint16_t height, std::vector<RGBpixel> const& pixels) : screen(width, height),
-			descriptors{ std::tuple{imageDescriptor(width,height),std::nullopt, pixels} },
-			GCT(colorTable(palletize(pixels))) {};
+		//Asking for more than the CPU has falls back to the best level it does support
+		pixelConverter(pixelFormat const from, pixelFormat const to = pixelFormat::rgb24, simdLevel const wanted = simdLevel::avx2) :
+			from(from), to(to), level(std::min(wanted, detectSimd())) {
+			std::fill(std::begin(convertMask), std::end(convertMask), uint8_t(0x80));
+			std::fill(std::begin(planeMask), std::end(planeMask), uint8_t(0x80));
+			std::fill(std::begin(storeMask), std::end(storeMask), uint8_t(0x80));
 
-		encoder(uint16_t width, uint16_t height, std::vector<std::vector<RGBpixel>> const& pixels, bool looping = true) : screen(width, height),
-			GCT(colorTable(palletize(pixels[0]))) {
-			if (looping)
-				loop = applicationExtensionLoop();
-			for (size_t i = 0; i < pixels.size(); i++) {
-				descriptors.emplace_back(std::tuple{ imageDescriptor(width,height),std::nullopt,pixels[i] });
+			auto const inStep = bytes(from);
+			auto const outStep = bytes(to);
+			auto const src = offsets(from);
+			auto const dst = offsets(to);
+			for (size_t k = 0; k < 4; k++) {
+				for (size_t c = 0; c < 3; c++) {
+					convertMask[k * outStep + dst[c]] = uint8_t(k * inStep + src[c]);
+					planeMask[c * 4 + k] = uint8_t(k * inStep + src[c]);
+					storeMask[k * outStep + dst[c]] = uint8_t(k * 4 + c);
+				}
+				if (outStep == 4) {
+					if (inStep == 4)
+						convertMask[k * 4 + 3] = uint8_t(k * 4 + 3);
+					storeMask[k * 4 + 3] = uint8_t(k * 4 + 3);
+				}
 			}
-		};
-
-		encoder() = default;
-
-		//This function returns a std::bitset<N> by design where N is the amount of bits needed to store colortable+clearcode+stopcode+generated codes
-		//bitset size can't be determined just based on the function input since it depends on the pixels how many codes are generated in the table
-		//a lower bound can be determined though based on the size of the colortable
-		auto lzw_encode(std::vector<byte> const& in, size_t const colorTableBits) -> lzw_code {
-			auto const lzw_code_size = colorTableBits; //number of color bits??
-			uint16_t const clearCode = size_t(1) << lzw_code_size;
-			uint16_t const end_of_info = clearCode + 1;
+		}
 
-			uint16_t compressionID = clearCode + 1;
-			//uint16_t codeBits = lzw_code_size + 1;
+		//count pixels from the source layout to the target layout
+		void convert(uint8_t const* in, uint8_t* out, size_t const count) const {
+			if (count == 0)
+				return;
+			if (from == to) {
+				std::memcpy(out, in, count * bytes(from));
+				return;
+			}
+			size_t done = 0;
+			switch (level) {
+#if defined(GIF_X86)
+			case simdLevel::avx2:
+				done = convertAVX2(in, out, count);
+				break;
+			case simdLevel::sse41:
+				done = convertSSSE3(in, out, count);
+				break;
+#endif
+			default:
+				break;
+			}
+			convertScalar(in + done * bytes(from), out + done * bytes(to), count - done);
+		}
 
-			std::map<uint16_t, std::vector<byte>> table;
+		//count pixels from the source layout to three planes
+		void split(uint8_t const* in, size_t const count, uint8_t* r, uint8_t* g, uint8_t* b) const {
+			size_t done = 0;
+			switch (level) {
+#if defined(GIF_X86)
+			case simdLevel::avx2:
+				done = splitAVX2(in, count, r, g, b);
+				break;
+			case simdLevel::sse41:
+				done = splitSSSE3(in, count, r, g, b);
+				break;
+#endif
+			default:
+				break;
+			}
+			splitScalar(in + done * bytes(from), count - done, r + done, g + done, b + done);
+		}
 
-			//initialize with our palette we should really clean this up, it's close to overflow
-			for (auto i = size_t(0); i < (size_t(1) << colorTableBits); i++) {
-				table[uint16_t(i)] = { byte(i) };
+		//count pixels from three planes to the target layout
+		void join(uint8_t const* r, uint8_t const* g, uint8_t const* b, size_t const count, uint8_t* out) const {
+			size_t done = 0;
+			switch (level) {
+#if defined(GIF_X86)
+			case simdLevel::avx2:
+				done = joinAVX2(r, g, b, count, out);
+				break;
+			case simdLevel::sse41:
+				done = joinSSSE3(r, g, b, count, out);
+				break;
+#endif
+			default:
+				break;
 			}
+			joinScalar(r + done, g + done, b + done, count - done, out + done * bytes(to));
+		}
+	};
 
-			table[clearCode] = std::vector{ byte((clearCode & 0xf00) >> 8),byte(clearCode & 0xff) }; //This doesn't find it a byte
-			table[end_of_info] = std::vector{ byte((end_of_info & 0xf00) >> 8),byte(end_of_info & 0xff) }; //this doesn't fit in a byte
+	//Non owning view of pixels in a caller's buffer, in any pixelFormat and with padded rows.
+	//The buffer has to stay alive and unchanged for as long as the view is used.
+	class pixelView {
+	private:
+		uint8_t const* base = nullptr;
+		size_t wide = 0;
+		size_t high = 0;
+		size_t stride = 0; //Bytes from the start of one row to the next
+		pixelFormat layout = pixelFormat::rgb24;
 
-			std::vector<uint16_t> out;
+		//Only set by copyOf, keeps the pixels alive through copies of the view
+		std::shared_ptr<std::vector<RGBpixel> const> owned;
 
-			out.push_back(clearCode);
+	public:
+		pixelView() = default;
 
-			//Push first pixel right on to output
-			out.push_back(uint16_t(in[0]));
+		//rowBytes of 0 means the rows are packed
+		pixelView(void const* data, size_t width, size_t height, pixelFormat format = pixelFormat::rgb24, size_t rowBytes = 0) :
+			base(static_cast<uint8_t const*>(data)), wide(width), high(height), layout(format) {
+			stride = rowBytes != 0 ? rowBytes : width * bytesPerPixel();
+			if (stride < width * bytesPerPixel())
+				throw std::invalid_argument("Rows overlap");
+		}
 
-			//Second pixel is always added to the map
-			//table[++compressionID] = std::vector{ in[0],in[1] };
+		pixelView(std::vector<RGBpixel> const& pixels, size_t width, size_t height) :
+			pixelView(pixels.data(), width, height) {
+			static_assert(sizeof(RGBpixel) == 3, "RGBpixel has to be packed to be viewed as rgb24");
+			if (pixels.size() != width * height)
+				throw std::invalid_argument("Frame does not cover the screen");
+		}
 
-			//initial state from which the algorithm can operate
-			std::vector<byte> hash{ in[1] };
-			uint16_t currentKey = 0;
+		//Owning view for callers that hand over a vector, copies of the view share it
+		static auto copyOf(std::vector<RGBpixel> const& pixels, size_t width, size_t height) -> pixelView {
+			auto storage = std::make_shared<std::vector<RGBpixel> const>(pixels);
+			auto view = pixelView(*storage, width, height);
+			view.owned = std::move(storage);
+			return view;
+		}
 
-			auto earlyResult = std::find_if(table.begin(), table.end(), [hash](auto const& kv) -> bool {
-				return kv.second == hash;
-				});
+		auto width() const -> size_t {
+			return wide;
+		}
 
-			//this has to always succeed or the input data has more range than the colortable
-			if (earlyResult != table.end()) {
-				currentKey = earlyResult->first;
-			}
+		auto height() const -> size_t {
+			return high;
+		}
 
-			//Always add first string to table
-			table[++compressionID] = std::vector{ in[0],in[1] };
+		auto size() const -> size_t {
+			return wide * high;
+		}
 
-			//For some reason currentkey starts updating at some point for some inputs
-			for (size_t i = 2; i < in.size(); i++) {
+		auto format() const -> pixelFormat {
+			return layout;
+		}
 
-				hash.emplace_back(in[i]);
+		auto bytesPerPixel() const -> size_t {
+			return layout == pixelFormat::rgb24 ? 3 : 4;
+		}
 
-				auto result = std::find_if(table.begin(), table.end(), [hash](auto const& kv) -> bool {
-					return kv.second == hash;
+		//Offsets of red, green and blue inside a pixel
+		auto channels() const -> std::tuple<size_t, size_t, size_t> {
+			return layout == pixelFormat::bgra32 ? std::tuple{ size_t(2), size_t(1), size_t(0) } : std::tuple{ size_t(0), size_t(1), size_t(2) };
+		}
+
+		auto row(size_t const y) const -> uint8_t const* {
+			return base + y * stride;
+		}
+
+		auto at(size_t const x, size_t const y) const -> RGBpixel {
+			auto const [r, g, b] = channels();
+			auto const* p = row(y) + x * bytesPerPixel();
+			return RGBpixel{ p[r], p[g], p[b] };
+		}
+
+		//Rectangle of this view without copying anything
+		auto sub(region const& area) const -> pixelView {
+			auto view = *this;
+			view.base = row(area.top) + area.left * bytesPerPixel();
+			view.wide = area.width;
+			view.high = area.height;
+			return view;
+		}
+
+		auto toVector() const -> std::vector<RGBpixel> {
+			std::vector<RGBpixel> out;
+			copyTo(out);
+			return out;
+		}
+
+		//Reuses the capacity out already has
+		void copyTo(std::vector<RGBpixel>& out) const {
+			out.resize(size());
+			pixelConverter const converter(layout);
+			for (size_t y = 0; y < high; y++) {
+				converter.convert(row(y), reinterpret_cast<uint8_t*>(out.data() + y * wide), wide);
+			}
+		}
+
+		//Hands f(pixels, count, index) the view as runs of packed RGB, index counts pixels from the top left.
+		//RGB24 rows come straight from the buffer, other layouts are converted on the stack a piece at a time.
+		template<typename F>
+		void forEachRun(F&& f, simdLevel const wanted = simdLevel::avx2) const {
+			if (layout == pixelFormat::rgb24) {
+				for (size_t y = 0; y < high; y++) {
+					f(reinterpret_cast<RGBpixel const*>(row(y)), wide, y * wide);
+				}
+				return;
+			}
+
+			constexpr size_t chunk = 256;
+			RGBpixel scratch[chunk];
+			pixelConverter const converter(layout, pixelFormat::rgb24, wanted);
+			for (size_t y = 0; y < high; y++) {
+				for (size_t x = 0; x < wide; x += chunk) {
+					auto const count = std::min(chunk, wide - x);
+					converter.convert(row(y) + x * bytesPerPixel(), reinterpret_cast<uint8_t*>(scratch), count);
+					f(static_cast<RGBpixel const*>(scratch), count, y * wide + x);
+				}
+			}
+		}
+	};
+
+	//Splits the bucket in place at its median along the channel with the widest range and returns the split point.
+	//The other channels break ties so the halves don't depend on the order pixels came in.
+	auto median_cut(RGBpixel* const first, RGBpixel* const last) -> RGBpixel* {
+		if (first == last) {
+			return first;
+		}
+
+		uint8_t lo[3] = { 255, 255, 255 };
+		uint8_t hi[3] = { 0, 0, 0 };
+		for (auto p = first; p != last; ++p) {
+			lo[0] = std::min(lo[0], p->r);
+			hi[0] = std::max(hi[0], p->r);
+			lo[1] = std::min(lo[1], p->g);
+			hi[1] = std::max(hi[1], p->g);
+			lo[2] = std::min(lo[2], p->b);
+			hi[2] = std::max(hi[2], p->b);
+		}
+
+		//First channel wins when ranges are equal
+		int greatest = 0;
+		for (int c = 1; c < 3; c++) {
+			if (hi[c] - lo[c] > hi[greatest] - lo[greatest])
+				greatest = c;
+		}
+
+		auto const middle = first + (last - first) / 2;
+		switch (greatest) {
+		case 0:
+			std::nth_element(first, middle, last, [](RGBpixel const& i, RGBpixel const& j) {
+				return std::tie(i.r, i.g, i.b) < std::tie(j.r, j.g, j.b);
+				});
+			break;
+		case 1:
+			std::nth_element(first, middle, last, [](RGBpixel const& i, RGBpixel const& j) {
+				return std::tie(i.g, i.r, i.b) < std::tie(j.g, j.r, j.b);
+				});
+			break;
+		default:
+			std::nth_element(first, middle, last, [](RGBpixel const& i, RGBpixel const& j) {
+				return std::tie(i.b, i.r, i.g) < std::tie(j.b, j.r, j.g);
+				});
+			break;
+		}
+		return middle;
+	}
+
+	auto median_cut(std::vector<RGBpixel> const& pixels) -> std::pair<std::vector<RGBpixel>, std::vector<RGBpixel>> {
+		auto bucket = pixels;
+		auto const middle = median_cut(bucket.data(), bucket.data() + bucket.size());
+		return std::pair{ std::vector<RGBpixel>(bucket.data(), middle), std::vector<RGBpixel>(middle, bucket.data() + bucket.size()) };
+	}
+
+	auto average(RGBpixel const* const first, RGBpixel const* const last) -> RGBpixel {
+		RGBpixel32 sum;
+		for (auto p = first; p != last; ++p) {
+			sum = sum + *p;
+		}
+
+		auto const count = size_t(last - first);
+		return RGBpixel{ uint8_t(sum.r / count),uint8_t(sum.g / count),uint8_t(sum.b / count) };
+	}
+
+	auto average(std::vector<RGBpixel> const& pixels) -> RGBpixel {
+		return average(pixels.data(), pixels.data() + pixels.size());
+	}
+
+	//Recursive cuts over one buffer, colors are appended left to right
+	void palletize(RGBpixel* const first, RGBpixel* const last, int const bitDepth, std::vector<RGBpixel>& out) {
+		if (bitDepth == 1) {
+			out.push_back(first != last ? average(first, last) : RGBpixel());
+			return;
+		}
+		auto const middle = median_cut(first, last);
+		palletize(first, middle, bitDepth / 2, out);
+		palletize(middle, last, bitDepth / 2, out);
+	}
+
+	//The cuts rearrange pixels, so a view is copied into the one buffer they work on
+	auto palletize(pixelView const& pixels, int bitDepth = 256) -> std::vector<RGBpixel> {
+		auto bucket = pixels.toVector();
+		std::vector<RGBpixel> out;
+		out.reserve(size_t(std::max(bitDepth, 1)));
+		palletize(bucket.data(), bucket.data() + bucket.size(), bitDepth, out);
+		return out;
+	}
+
+	auto palletize(std::vector<RGBpixel> const& pixels, int bitDepth = 256) -> std::vector<RGBpixel> {
+		return palletize(pixelView(pixels, pixels.size(), 1), bitDepth);
+	}
+
+	//Pixel counts and channel sums on a coarse RGB grid, memory and palette build time depend on the grid and not on the image
+	class colorHistogram {
+	private:
+		struct cell {
+			uint64_t count = 0;
+			uint64_t r = 0;
+			uint64_t g = 0;
+			uint64_t b = 0;
+		};
+
+		//Non empty cell with its mean color, which is what the cuts sort by
+		struct entry {
+			RGBpixel mean;
+			cell const* sums;
+		};
+
+		size_t bits;
+		std::vector<cell> cells;
+
+		static auto average(entry const* const first, entry const* const last) -> RGBpixel {
+			cell total;
+			for (auto e = first; e != last; ++e) {
+				total.count += e->sums->count;
+				total.r += e->sums->r;
+				total.g += e->sums->g;
+				total.b += e->sums->b;
+			}
+			return RGBpixel{ uint8_t(total.r / total.count), uint8_t(total.g / total.count), uint8_t(total.b / total.count) };
+		}
+
+		//Same cuts as palletize but the split sits where half of the pixels, not half of the cells, are on either side
+		static void cut(entry* const first, entry* const last, int const bitDepth, std::vector<RGBpixel>& out) {
+			if (bitDepth == 1) {
+				out.push_back(first != last ? average(first, last) : RGBpixel());
+				return;
+			}
+			if (last - first < 2) {
+				cut(first, last, bitDepth / 2, out);
+				cut(last, last, bitDepth / 2, out);
+				return;
+			}
+
+			uint8_t lo[3] = { 255, 255, 255 };
+			uint8_t hi[3] = { 0, 0, 0 };
+			for (auto e = first; e != last; ++e) {
+				lo[0] = std::min(lo[0], e->mean.r);
+				hi[0] = std::max(hi[0], e->mean.r);
+				lo[1] = std::min(lo[1], e->mean.g);
+				hi[1] = std::max(hi[1], e->mean.g);
+				lo[2] = std::min(lo[2], e->mean.b);
+				hi[2] = std::max(hi[2], e->mean.b);
+			}
+			int greatest = 0;
+			for (int c = 1; c < 3; c++) {
+				if (hi[c] - lo[c] > hi[greatest] - lo[greatest])
+					greatest = c;
+			}
+
+			switch (greatest) {
+			case 0:
+				std::sort(first, last, [](entry const& i, entry const& j) {
+					return std::tie(i.mean.r, i.mean.g, i.mean.b) < std::tie(j.mean.r, j.mean.g, j.mean.b);
+					});
+				break;
+			case 1:
+				std::sort(first, last, [](entry const& i, entry const& j) {
+					return std::tie(i.mean.g, i.mean.r, i.mean.b) < std::tie(j.mean.g, j.mean.r, j.mean.b);
+					});
+				break;
+			default:
+				std::sort(first, last, [](entry const& i, entry const& j) {
+					return std::tie(i.mean.b, i.mean.r, i.mean.g) < std::tie(j.mean.b, j.mean.r, j.mean.g);
+					});
+				break;
+			}
+
+			//Both halves keep at least one cell so a heavy cell can't swallow its neighbours
+			uint64_t total = 0;
+			for (auto e = first; e != last; ++e) {
+				total += e->sums->count;
+			}
+			auto middle = first + 1;
+			for (uint64_t below = first->sums->count; middle != last - 1 && below * 2 < total; ++middle) {
+				below += middle->sums->count;
+			}
+
+			cut(first, middle, bitDepth / 2, out);
+			cut(middle, last, bitDepth / 2, out);
+		}
+
+	public:
+		//5 bits per channel is 32768 cells, 6 bits keeps more detail for 262144
+		colorHistogram(size_t const bitsPerChannel = 5) : bits(bitsPerChannel) {
+			if (bits == 0 || bits > 8)
+				throw std::invalid_argument("Histogram needs between 1 and 8 bits per channel");
+			cells.resize(size_t(1) << (3 * bits));
+		}
+
+		void add(pixelView const& pixels) {
+			auto const shift = 8 - bits;
+			pixels.forEachRun([&](RGBpixel const* const p, size_t const count, size_t) {
+				for (size_t i = 0; i < count; i++) {
+					auto& c = cells[(size_t(p[i].r >> shift) << (2 * bits)) | (size_t(p[i].g >> shift) << bits) | size_t(p[i].b >> shift)];
+					c.count++;
+					c.r += p[i].r;
+					c.g += p[i].g;
+					c.b += p[i].b;
+				}
+				});
+		}
+
+		void add(RGBpixel const* const p, size_t const count) {
+			add(pixelView(p, count, 1));
+		}
+
+		void add(std::vector<RGBpixel> const& pixels) {
+			add(pixels.data(), pixels.size());
+		}
+
+		void clear() {
+			std::fill(cells.begin(), cells.end(), cell());
+		}
+
+		//Sums add up exactly, so histograms filled separately give the same palette as one filled with everything
+		void merge(colorHistogram const& other) {
+			if (other.bits != bits)
+				throw std::invalid_argument("Histograms use different grids");
+			for (size_t i = 0; i < cells.size(); i++) {
+				cells[i].count += other.cells[i].count;
+				cells[i].r += other.cells[i].r;
+				cells[i].g += other.cells[i].g;
+				cells[i].b += other.cells[i].b;
+			}
+		}
+
+		//Median cut over the occupied cells weighted by their pixel counts, padded with zeroes like palletize
+		auto palette(int const bitDepth = 256) const -> std::vector<RGBpixel> {
+			std::vector<entry> entries;
+			for (auto const& c : cells) {
+				if (c.count != 0)
+					entries.push_back(entry{ RGBpixel{ uint8_t(c.r / c.count), uint8_t(c.g / c.count), uint8_t(c.b / c.count) }, &c });
+			}
+
+			std::vector<RGBpixel> out;
+			out.reserve(size_t(std::max(bitDepth, 1)));
+			cut(entries.data(), entries.data() + entries.size(), bitDepth, out);
+			return out;
+		}
+	};
+
+	enum class quantizer {
+		medianCut, //Exact median cut over every pixel
+		histogram, //Median cut over a 5 bit per channel histogram, for large frames
+	};
+
+	auto quantize(pixelView const& pixels, quantizer const mode, int const bitDepth = 256) -> std::vector<RGBpixel> {
+		if (mode == quantizer::histogram) {
+			colorHistogram histogram;
+			histogram.add(pixels);
+			return histogram.palette(bitDepth);
+		}
+		return palletize(pixels, bitDepth);
+	}
+
+	auto quantize(std::vector<RGBpixel> const& pixels, quantizer const mode, int const bitDepth = 256) -> std::vector<RGBpixel> {
+		return quantize(pixelView(pixels, pixels.size(), 1), mode, bitDepth);
+	}
+
+	using lzw_code = std::variant<
+		std::vector<std::bitset<2>>,
+		std::vector<std::bitset<3>>,
+		std::vector<std::bitset<4>>,
+		std::vector<std::bitset<5>>,
+		std::vector<std::bitset<6>>,
+		std::vector<std::bitset<7>>,
+		std::vector<std::bitset<8>>,
+		std::vector<std::bitset<9>>,
+		std::vector<std::bitset<10>>,
+		std::vector<std::bitset<11>>,
+		std::vector<std::bitset<12>>,
+		std::vector<std::bitset<13>>,
+		std::vector<std::bitset<14>>
+	>;
+
+	template<std::size_t const n>
+	auto toBitset(std::vector<uint16_t> const& in) -> lzw_code {
+		auto buffer = std::vector<std::bitset<n>>(in.size());
+		for (size_t i = 0; i < buffer.size(); i++) {
+			buffer[i] = in[i];
+		}
+		return buffer;
+	}
+
+	//Packs codes least significant bit first, which is how GIF image data is laid out.
+	//Codes are gathered in a 64 bit accumulator and flushed to the output 32 bits at a time.
+	class bitWriter {
+	private:
+		std::vector<byte> out;
+		uint64_t accumulator = 0;
+		size_t pending = 0;
+
+	public:
+		bitWriter(size_t const expectedBytes = 0) {
+			out.reserve(expectedBytes);
+		}
+
+		//Writes into storage from a previous finish(), its capacity is kept
+		bitWriter(std::vector<byte>&& storage, size_t const expectedBytes) : out(std::move(storage)) {
+			out.clear();
+			out.reserve(expectedBytes);
+		}
+
+		//Up to 32 bits at once, the accumulator is below 32 bits between calls so it can't overflow
+		void write(uint32_t const code, size_t const width) {
+			accumulator |= uint64_t(code) << pending;
+			pending += width;
+			if (pending >= 32) {
+				auto const at = out.size();
+				out.resize(at + 4);
+				out[at + 0] = byte((accumulator >> 0) & 0xff);
+				out[at + 1] = byte((accumulator >> 8) & 0xff);
+				out[at + 2] = byte((accumulator >> 16) & 0xff);
+				out[at + 3] = byte((accumulator >> 24) & 0xff);
+				accumulator >>= 32;
+				pending -= 32;
+			}
+		}
+
+		//Number of bits written so far, including the ones still in the accumulator
+		auto bits() const -> size_t {
+			return out.size() * 8 + pending;
+		}
+
+		//Appends a stream produced by another writer, it doesn't have to start on a byte boundary here
+		void append(std::vector<byte> const& bytes, size_t bitCount) {
+			size_t i = 0;
+			for (; bitCount >= 32; i += 4, bitCount -= 32) {
+				write(uint32_t(bytes[i]) | (uint32_t(bytes[i + 1]) << 8) | (uint32_t(bytes[i + 2]) << 16) | (uint32_t(bytes[i + 3]) << 24), 32);
+			}
+			for (; bitCount > 0; i++) {
+				auto const width = std::min(bitCount, size_t(8));
+				write(uint32_t(bytes[i]) & ((1u << width) - 1), width);
+				bitCount -= width;
+			}
+		}
+
+		//Pads the last partial byte with zeroes and hands over the stream
+		auto finish() -> std::vector<byte> {
+			while (pending > 0) {
+				out.emplace_back(byte(accumulator & 0xff));
+				accumulator >>= 8;
+				pending = pending > 8 ? pending - 8 : 0;
+			}
+			accumulator = 0;
+			return std::move(out);
+		}
+	};
+
+	//Brute force nearest palette entry with the palette stored as structure of arrays.
+	//Every entry is a pair of 16 bit lanes (r, g) plus (b, 0) so one multiply-add gives r*r + g*g,
+	//8 entries per step with AVX2 and 4 with SSE4.1.
+	class paletteSearch {
+	private:
+		std::vector<int16_t> rg;
+		std::vector<int16_t> b0;
+		size_t entries = 0;
+		size_t padded = 0;
+		simdLevel level = simdLevel::scalar;
+
+		void mapScalar(RGBpixel const* const p, size_t const count, byte* out) const {
+			for (size_t i = 0; i < count; i++) {
+				int smallest = INT_MAX;
+				size_t pos = 0;
+				for (size_t j = 0; j < entries; j++) {
+					auto const dr = p[i].r - rg[2 * j];
+					auto const dg = p[i].g - rg[2 * j + 1];
+					auto const db = p[i].b - b0[2 * j];
+					if (auto d = dr * dr + dg * dg + db * db; d < smallest) {
+						smallest = d;
+						pos = j;
+					}
+				}
+				out[i] = byte(pos);
+			}
+		}
+
+#if defined(GIF_X86)
+		//Distances fit in 18 bits, the index goes in the low byte so a plain minimum picks the lowest index on ties
+		GIF_TARGET("sse4.1")
+		void mapSSE41(RGBpixel const* const p, size_t const count, byte* out) const {
+			auto const four = _mm_set1_epi32(4);
+			for (size_t i = 0; i < count; i++) {
+				auto const pixelRG = _mm_set1_epi32(int32_t(uint32_t(p[i].r) | (uint32_t(p[i].g) << 16)));
+				auto const pixelB = _mm_set1_epi32(int32_t(p[i].b));
+				auto best = _mm_set1_epi32(INT_MAX);
+				auto index = _mm_setr_epi32(0, 1, 2, 3);
+
+				for (size_t j = 0; j < padded; j += 4) {
+					auto const dRG = _mm_sub_epi16(pixelRG, _mm_loadu_si128(reinterpret_cast<__m128i const*>(rg.data() + 2 * j)));
+					auto const dB = _mm_sub_epi16(pixelB, _mm_loadu_si128(reinterpret_cast<__m128i const*>(b0.data() + 2 * j)));
+					auto const d = _mm_add_epi32(_mm_madd_epi16(dRG, dRG), _mm_madd_epi16(dB, dB));
+					best = _mm_min_epi32(best, _mm_or_si128(_mm_slli_epi32(d, 8), index));
+					index = _mm_add_epi32(index, four);
+				}
+
+				best = _mm_min_epi32(best, _mm_shuffle_epi32(best, _MM_SHUFFLE(1, 0, 3, 2)));
+				best = _mm_min_epi32(best, _mm_shuffle_epi32(best, _MM_SHUFFLE(2, 3, 0, 1)));
+				out[i] = byte(_mm_cvtsi128_si32(best) & 0xFF);
+			}
+		}
+
+		GIF_TARGET("avx2")
+		void mapAVX2(RGBpixel const* const p, size_t const count, byte* out) const {
+			auto const eight = _mm256_set1_epi32(8);
+			for (size_t i = 0; i < count; i++) {
+				auto const pixelRG = _mm256_set1_epi32(int32_t(uint32_t(p[i].r) | (uint32_t(p[i].g) << 16)));
+				auto const pixelB = _mm256_set1_epi32(int32_t(p[i].b));
+				auto best = _mm256_set1_epi32(INT_MAX);
+				auto index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+				for (size_t j = 0; j < padded; j += 8) {
+					auto const dRG = _mm256_sub_epi16(pixelRG, _mm256_loadu_si256(reinterpret_cast<__m256i const*>(rg.data() + 2 * j)));
+					auto const dB = _mm256_sub_epi16(pixelB, _mm256_loadu_si256(reinterpret_cast<__m256i const*>(b0.data() + 2 * j)));
+					auto const d = _mm256_add_epi32(_mm256_madd_epi16(dRG, dRG), _mm256_madd_epi16(dB, dB));
+					best = _mm256_min_epi32(best, _mm256_or_si256(_mm256_slli_epi32(d, 8), index));
+					index = _mm256_add_epi32(index, eight);
+				}
+
+				auto half = _mm_min_epi32(_mm256_castsi256_si128(best), _mm256_extracti128_si256(best, 1));
+				half = _mm_min_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+				half = _mm_min_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+				out[i] = byte(_mm_cvtsi128_si32(half) & 0xFF);
+			}
+		}
+#endif
+
+	public:
+		//Asking for more than the CPU has falls back to the best level it does support
+		paletteSearch(colorTable const& m, simdLevel const wanted = simdLevel::avx2) :
+			entries(m.table.size()), level(std::min(wanted, detectSimd())) {
+			if (entries == 0 || entries > 256)
+				throw std::invalid_argument("Palette needs between 1 and 256 colors");
+
+			//Padding repeats the first entry, a copy never beats the lower index it was copied from
+			padded = (entries + 7) / 8 * 8;
+			rg.resize(2 * padded);
+			b0.resize(2 * padded);
+			for (size_t j = 0; j < padded; j++) {
+				auto const& c = m.table[j < entries ? j : 0];
+				rg[2 * j] = c.r;
+				rg[2 * j + 1] = c.g;
+				b0[2 * j] = c.b;
+				b0[2 * j + 1] = 0;
+			}
+		}
+
+		void map(RGBpixel const* p, size_t const count, byte* out) const {
+			switch (level) {
+#if defined(GIF_X86)
+			case simdLevel::avx2:
+				mapAVX2(p, count, out);
+				break;
+			case simdLevel::sse41:
+				mapSSE41(p, count, out);
+				break;
+#endif
+			default:
+				mapScalar(p, count, out);
+				break;
+			}
+		}
+
+		//Indices come out row after row without padding
+		void map(pixelView const& pixels, byte* out) const {
+			pixels.forEachRun([&](RGBpixel const* const p, size_t const count, size_t const at) {
+				map(p, count, out + at);
+				}, level);
+		}
+	};
+
+	auto mapPixels(pixelView const& p, colorTable const& m) -> std::vector<byte> {
+		std::vector<byte> out(p.size());
+		paletteSearch(m).map(p, out.data());
+		return out;
+	}
+
+	auto mapPixels(std::vector<RGBpixel> const& p, colorTable const& m) -> std::vector<byte> {
+		return mapPixels(pixelView(p, p.size(), 1), m);
+	}
+
+	enum class colorMapping {
+		exact,			//Always the closest palette entry, same result as the brute force search
+		approximate,	//Closest entry to the middle of the pixel's cell, one lookup per pixel
+	};
+
+	//Precomputed answers to "which palette entry is closest" for a grid of cells over the RGB cube.
+	//For exact lookups every cell keeps the entries that can be the closest one for some color inside it:
+	//anything whose nearest corner is further away than the furthest corner of the best entry can never win.
+	//Build it once per palette and share it between every frame that uses that palette.
+	class inverseColorMap {
+	private:
+		size_t bits = 5;
+		colorMapping mode = colorMapping::exact;
+		std::vector<RGBpixel> palette;
+
+		//Candidates of cell c are candidates[offsets[c]] up to candidates[offsets[c + 1]], in palette order
+		std::vector<uint32_t> offsets;
+		std::vector<uint8_t> candidates;
+		std::vector<uint8_t> nearest;
+
+		auto cell(RGBpixel const& p) const -> size_t {
+			auto const shift = 8 - bits;
+			return (size_t(p.r >> shift) << (2 * bits)) | (size_t(p.g >> shift) << bits) | size_t(p.b >> shift);
+		}
+
+		static auto distance(RGBpixel const& lhs, RGBpixel const& rhs) -> int {
+			return ((rhs.r - lhs.r) * (rhs.r - lhs.r)) +
+				((rhs.g - lhs.g) * (rhs.g - lhs.g)) +
+				((rhs.b - lhs.b) * (rhs.b - lhs.b));
+		}
+
+	public:
+		inverseColorMap(colorTable const& m, colorMapping const mode = colorMapping::exact, size_t const bitsPerChannel = 5) :
+			bits(std::clamp(bitsPerChannel, size_t(1), size_t(6))), mode(mode), palette(m.table) {
+			if (palette.empty() || palette.size() > 256)
+				throw std::invalid_argument("Palette needs between 1 and 256 colors");
+
+			auto const side = size_t(1) << bits;
+			auto const step = 256 / side;
+			auto const cells = side * side * side;
+
+			if (mode == colorMapping::approximate) {
+				nearest.resize(cells);
+				for (size_t c = 0; c < cells; c++) {
+					auto const center = RGBpixel{
+						uint8_t(((c >> (2 * bits)) & (side - 1)) * step + step / 2),
+						uint8_t(((c >> bits) & (side - 1)) * step + step / 2),
+						uint8_t((c & (side - 1)) * step + step / 2) };
+
+					int smallest = INT_MAX;
+					for (size_t j = 0; j < palette.size(); j++) {
+						if (auto d = distance(center, palette[j]); d < smallest) {
+							smallest = d;
+							nearest[c] = uint8_t(j);
+						}
+					}
+				}
+				return;
+			}
+
+			//Squared distance along one axis from every slab of cells to every entry, closest and furthest point
+			auto const entries = palette.size();
+			std::vector<int> axisMin(3 * side * entries);
+			std::vector<int> axisMax(3 * side * entries);
+			for (size_t k = 0; k < side; k++) {
+				int const lo = int(k * step);
+				int const hi = int((k + 1) * step) - 1;
+				for (size_t j = 0; j < entries; j++) {
+					int const values[3] = { palette[j].r, palette[j].g, palette[j].b };
+					for (size_t channel = 0; channel < 3; channel++) {
+						auto const v = values[channel];
+						auto const near = v < lo ? lo - v : (v > hi ? v - hi : 0);
+						auto const far = std::max(v - lo, hi - v);
+						axisMin[(channel * side + k) * entries + j] = near * near;
+						axisMax[(channel * side + k) * entries + j] = far * far;
+					}
+				}
+			}
+
+			offsets.resize(cells + 1);
+			std::vector<int> lowest(entries);
+			for (size_t c = 0; c < cells; c++) {
+				int const* const minR = &axisMin[(0 * side + ((c >> (2 * bits)) & (side - 1))) * entries];
+				int const* const minG = &axisMin[(1 * side + ((c >> bits) & (side - 1))) * entries];
+				int const* const minB = &axisMin[(2 * side + (c & (side - 1))) * entries];
+				int const* const maxR = &axisMax[(0 * side + ((c >> (2 * bits)) & (side - 1))) * entries];
+				int const* const maxG = &axisMax[(1 * side + ((c >> bits) & (side - 1))) * entries];
+				int const* const maxB = &axisMax[(2 * side + (c & (side - 1))) * entries];
+
+				int bound = INT_MAX;
+				for (size_t j = 0; j < entries; j++) {
+					lowest[j] = minR[j] + minG[j] + minB[j];
+					bound = std::min(bound, maxR[j] + maxG[j] + maxB[j]);
+				}
+
+				offsets[c] = uint32_t(candidates.size());
+				for (size_t j = 0; j < entries; j++) {
+					if (lowest[j] <= bound)
+						candidates.emplace_back(uint8_t(j));
+				}
+			}
+			offsets[cells] = uint32_t(candidates.size());
+		}
+
+		auto lookup(RGBpixel const& p) const -> uint8_t {
+			auto const c = cell(p);
+			if (mode == colorMapping::approximate)
+				return nearest[c];
+
+			int smallest = INT_MAX;
+			uint8_t pos = 0;
+			for (auto i = offsets[c]; i < offsets[c + 1]; i++) {
+				if (auto d = distance(p, palette[candidates[i]]); d < smallest) {
+					smallest = d;
+					pos = candidates[i];
+				}
+			}
+			return pos;
+		}
+
+		//Indices come out row after row without padding, same as paletteSearch::map
+		void map(pixelView const& pixels, byte* out) const {
+			pixels.forEachRun([&](RGBpixel const* const p, size_t const count, size_t const at) {
+				for (size_t i = 0; i < count; i++) {
+					out[at + i] = byte(lookup(p[i]));
+				}
+				});
+		}
+	};
+
+	auto mapPixels(pixelView const& p, inverseColorMap const& m) -> std::vector<byte> {
+		std::vector<byte> out(p.size());
+		m.map(p, out.data());
+		return out;
+	}
+
+	auto mapPixels(std::vector<RGBpixel> const& p, inverseColorMap const& m) -> std::vector<byte> {
+		return mapPixels(pixelView(p, p.size(), 1), m);
+	}
+
+	//Sum of squared channel differences between the pixels and the palette colors they were mapped to
+	auto mappingError(pixelView const& p, std::vector<byte> const& indices, colorTable const& m) -> uint64_t {
+		uint64_t sum = 0;
+		p.forEachRun([&](RGBpixel const* const pixels, size_t const count, size_t const at) {
+			for (size_t i = 0; i < count; i++) {
+				auto const& c = m.table[size_t(indices[at + i])];
+				auto const dr = int(pixels[i].r) - int(c.r);
+				auto const dg = int(pixels[i].g) - int(c.g);
+				auto const db = int(pixels[i].b) - int(c.b);
+				sum += uint64_t(dr * dr + dg * dg + db * db);
+			}
+			});
+		return sum;
+	}
+
+	auto mappingError(std::vector<RGBpixel> const& p, std::vector<byte> const& indices, colorTable const& m) -> uint64_t {
+		return mappingError(pixelView(p, p.size(), 1), indices, m);
+	}
+
+	enum class localColorTables {
+		never,
+		adaptive, //Only where the drop in mapping error pays for the table
+		always,
+	};
+
+
+	//What the LZW encoder does once all 4096 codes are in use
+	enum class dictionaryPolicy {
+		clear,		//Emit a clear code and start over with an empty table
+		deferred,	//Keep encoding with the full table frozen, no clear code is sent
+		adaptive,	//Stay frozen while the compression ratio holds up, clear once it drops
+	};
+
+	//How hard the LZW encoder looks for a shorter code stream, every level writes a stream any decoder reads
+	enum class compressionLevel {
+		fast,		//Greedy, always the longest string in the table
+		lookahead,	//Takes a shorter string when that lets the next one reach further
+		best,		//Lookahead, and a full table is cleared wherever starting over costs fewer bits, whatever the policy
+	};
+
+	//Maps a (prefix code, next index) pair to the code of the extended string.
+	//Every LZW string is a known string plus one index, so we never store the strings themselves.
+	//Open addressing with linear probing, the table doubles once it is half full.
+	class codeTable {
+	private:
+		static constexpr uint32_t empty = UINT32_MAX;
+
+		std::vector<uint32_t> keys;
+		std::vector<uint16_t> codes;
+		size_t used = 0;
+		size_t shift = 32;
+
+		static auto key(uint16_t const prefix, uint16_t const next) -> uint32_t {
+			return (uint32_t(prefix) << 8) | next;
+		}
+
+		//Fibonacci hashing, the top bits of the product are the well mixed ones
+		auto slot(uint32_t const k) const -> size_t {
+			return size_t(uint32_t(k * 0x9E3779B1u) >> shift);
+		}
+
+		void resize(size_t const capacity) {
+			keys.assign(capacity, empty);
+			codes.assign(capacity, 0);
+			shift = 32;
+			for (auto c = capacity; c > 1; c >>= 1)
+				shift--;
+		}
+
+		void grow() {
+			auto const oldKeys = std::move(keys);
+			auto const oldCodes = std::move(codes);
+			resize(oldKeys.size() * 2);
+			for (size_t i = 0; i < oldKeys.size(); i++) {
+				if (oldKeys[i] == empty)
+					continue;
+				auto at = slot(oldKeys[i]);
+				while (keys[at] != empty)
+					at = (at + 1) & (keys.size() - 1);
+				keys[at] = oldKeys[i];
+				codes[at] = oldCodes[i];
+			}
+		}
+
+	public:
+		//Capacity has to be a power of two
+		codeTable(size_t const capacity = 8192) {
+			resize(capacity);
+		}
+
+		auto find(uint16_t const prefix, uint16_t const next) const -> std::optional<uint16_t> {
+			auto const k = key(prefix, next);
+			for (auto at = slot(k); keys[at] != empty; at = (at + 1) & (keys.size() - 1)) {
+				if (keys[at] == k)
+					return codes[at];
+			}
+			return std::nullopt;
+		}
+
+		void insert(uint16_t const prefix, uint16_t const next, uint16_t const code) {
+			if ((used + 1) * 2 > keys.size())
+				grow();
+
+			auto const k = key(prefix, next);
+			auto at = slot(k);
+			while (keys[at] != empty && keys[at] != k)
+				at = (at + 1) & (keys.size() - 1);
+			if (keys[at] == empty)
+				used++;
+			keys[at] = k;
+			codes[at] = code;
+		}
+
+		void clear() {
+			std::fill(keys.begin(), keys.end(), empty);
+			used = 0;
+		}
+	};
+
+	//Palette side of lossy LZW, see encoder::setLossy. Every entry lists the entries within twice maxError of it,
+	//nearest first and itself included, a pixel can only take one of those within maxError of its own color.
+	//The transparent index stands in for nothing and nothing stands in for it.
+	class lossyPalette {
+	public:
+		std::vector<RGBpixel> colors;
+		std::vector<std::vector<uint8_t>> near;
+		int limit = 0; //maxError squared
+		std::optional<uint8_t> transparent;
+
+		static auto distance(RGBpixel const& lhs, RGBpixel const& rhs) -> int {
+			return ((rhs.r - lhs.r) * (rhs.r - lhs.r)) +
+				((rhs.g - lhs.g) * (rhs.g - lhs.g)) +
+				((rhs.b - lhs.b) * (rhs.b - lhs.b));
+		}
+
+		lossyPalette(colorTable const& table, uint32_t const maxError, std::optional<uint8_t> const transparentIndex = std::nullopt) :
+			colors(table.table), transparent(transparentIndex) {
+			if (colors.empty() || colors.size() > 256)
+				throw std::invalid_argument("Palette must have 1 to 256 entries");
+			auto const error = int(std::min(maxError, uint32_t(442))); //Farther than black is from white changes nothing
+			limit = error * error;
+			near.resize(colors.size());
+			for (size_t p = 0; p < colors.size(); p++) {
+				if (transparent == p) {
+					near[p] = { uint8_t(p) };
+					continue;
+				}
+				std::vector<std::pair<int, uint8_t>> close;
+				for (size_t q = 0; q < colors.size(); q++) {
+					auto const d = distance(colors[p], colors[q]);
+					if (transparent != q && (q == p || d <= 4 * limit))
+						close.emplace_back(q == p ? -1 : d, uint8_t(q));
+				}
+				std::sort(close.begin(), close.end());
+				for (auto const& [d, q] : close)
+					near[p].push_back(q);
+			}
+		}
+	};
+
+	//Image row of the n-th row an interlaced image stores. Rows are stored pass by pass,
+	//every 8th row from 0, every 8th from 4, every 4th from 2, then the odd ones.
+	auto interlacedRow(size_t n, size_t const height) -> size_t {
+		auto const first = (height + 7) / 8;
+		if (n < first)
+			return n * 8;
+		n -= first;
+		auto const second = (height + 3) / 8;
+		if (n < second)
+			return n * 8 + 4;
+		n -= second;
+		auto const third = (height + 1) / 4;
+		if (n < third)
+			return n * 4 + 2;
+		return (n - third) * 2 + 1;
+	}
+
+	//Indices of an image in the order an interlaced GIF stores them, read in place through the row order.
+	//LZW reads front to back, so the row being read is kept rather than looked up again for every index.
+	//skip starts the view that many indices into the stored order, always whole rows.
+	class interlacedIndices {
+	private:
+		byte const* data = nullptr;
+		size_t width = 0;
+		size_t height = 0;
+		size_t skip = 0;
+		mutable size_t rowStart = 0;
+		mutable size_t rowEnd = 0;
+		mutable byte const* row = nullptr;
+
+	public:
+		interlacedIndices(byte const* indices, size_t const rowWidth, size_t const rows, size_t const skipped = 0) :
+			data(indices), width(std::max(rowWidth, size_t(1))), height(rows), skip(skipped) {}
+
+		auto operator[](size_t const i) const -> byte {
+			if (i < rowStart || i >= rowEnd)
+				seek(i);
+			return row[i - rowStart];
+		}
+
+		//The indices from i to the end of its row, which lie next to each other in memory
+		auto run(size_t const i) const -> std::pair<byte const*, size_t> {
+			if (i < rowStart || i >= rowEnd)
+				seek(i);
+			return { row + (i - rowStart), rowEnd - i };
+		}
+
+	private:
+		void seek(size_t const i) const {
+			auto const n = (i + skip) / width;
+			rowStart = n * width - skip;
+			rowEnd = rowStart + width;
+			row = data + interlacedRow(n, height) * width;
+		}
+	};
+
+	//Indices from at up to size that lie next to each other in memory, at least one of them
+	auto runAt(byte const* const in, size_t const at, size_t const size) -> std::pair<byte const*, size_t> {
+		return { in + at, size - at };
+	}
+
+	auto runAt(interlacedIndices const& in, size_t const at, size_t const size) -> std::pair<byte const*, size_t> {
+		auto const [run, length] = in.run(at);
+		return { run, std::min(length, size - at) };
+	}
+
+	//What lossy LZW aims for, pixels holds the color of every index. The indices start at firstRow of the stored
+	//order, which for an interlaced image is not the order of the rows in pixels.
+	struct lossyTarget {
+		pixelView pixels;
+		lossyPalette const* palette = nullptr;
+		size_t firstRow = 0;
+		bool interlaced = false;
+	};
+
+	//Runs work for every index in [0, count) on up to workers threads, each thread pulls the next index off a shared counter.
+	//The first exception thrown by any of them is rethrown on the calling thread.
+	template<typename Work>
+	void parallelFor(size_t const count, size_t const workers, Work const& work) {
+		if (std::min(workers, count) <= 1) {
+			for (size_t i = 0; i < count; i++)
+				work(i);
+			return;
+		}
+
+		std::atomic<size_t> next = 0;
+		std::exception_ptr failure;
+		std::mutex failureLock;
+
+		std::vector<std::thread> pool;
+		for (size_t w = 0; w < std::min(workers, count); w++) {
+			pool.emplace_back([&] {
+				try {
+					for (size_t i = next++; i < count; i = next++)
+						work(i);
+				}
+				catch (...) {
+					std::lock_guard<std::mutex> lock(failureLock);
+					if (!failure)
+						failure = std::current_exception();
+				}
+				});
+		}
+		for (auto& t : pool)
+			t.join();
+
+		if (failure)
+			std::rethrow_exception(failure);
+	}
+
+	//One palette for a whole animation. Each worker fills a histogram from a run of frames, so memory is
+	//one grid per worker however many frames there are, and the cost is linear in the total pixel count.
+	auto globalPalette(std::vector<pixelView> const& frames, int const bitDepth = 256, size_t const workers = 1,
+		size_t const bitsPerChannel = 5) -> std::vector<RGBpixel> {
+		auto const runs = std::max(size_t(1), std::min(workers, frames.size()));
+		std::vector<colorHistogram> partial(runs, colorHistogram(bitsPerChannel));
+
+		parallelFor(runs, runs, [&](size_t const run) {
+			for (size_t i = run * frames.size() / runs; i < (run + 1) * frames.size() / runs; i++) {
+				partial[run].add(frames[i]);
+			}
+			});
+
+		for (size_t run = 1; run < runs; run++) {
+			partial[0].merge(partial[run]);
+		}
+		return partial[0].palette(bitDepth);
+	}
+
+	auto globalPalette(std::vector<std::vector<RGBpixel>> const& frames, int const bitDepth = 256, size_t const workers = 1,
+		size_t const bitsPerChannel = 5) -> std::vector<RGBpixel> {
+		std::vector<pixelView> views;
+		for (auto const& frame : frames) {
+			views.emplace_back(frame, frame.size(), 1);
+		}
+		return globalPalette(views, bitDepth, workers, bitsPerChannel);
+	}
+
+	void writeColorTable(std::vector<byte>& out, colorTable const& table) {
+		auto writer = appendTo(out, table.size());
+		table.write(writer);
+	}
+
+	//Bytes writeImageData produces for this much compressed data
+	auto imageDataSize(size_t const compressedBytes) -> size_t {
+		return 1 + compressedBytes + (compressedBytes + 0xfe) / 0xff + 1;
+	}
+
+	//LZW minimum code size followed by the compressed data in sub-blocks of at most 255 bytes
+	void writeImageData(byteWriter& out, std::vector<byte> const& bytes, size_t const minCodeSize) {
+		out.put(byte(minCodeSize));
+
+		auto bytesLeft = bytes.size();
+		auto amountOfBlocks = bytesLeft / 0xff;
+		for (size_t block = 0; block < amountOfBlocks; block++) {
+			out.put(byte(0xff)); //Block size
+			out.put(bytes.data() + block * 0xff, 0xff);
+		}
+		bytesLeft -= amountOfBlocks * 0xff;
+
+		//A zero sized block would end the image early
+		if (bytesLeft > 0) {
+			out.put(byte(bytesLeft));
+			out.put(bytes.data() + bytes.size() - bytesLeft, bytesLeft);
+		}
+		out.put(byte(0)); //END of image block
+	}
+
+	void writeImageData(std::vector<byte>& out, std::vector<byte> const& bytes, size_t const minCodeSize) {
+		auto writer = appendTo(out, imageDataSize(bytes.size()));
+		writeImageData(writer, bytes, minCodeSize);
+	}
+
+	//Same red, green and blue for count pixels from (x, y) on in both views, alpha doesn't count
+	auto samePixels(pixelView const& lhs, pixelView const& rhs, size_t const x, size_t const y, size_t const count) -> bool {
+		auto const step = lhs.bytesPerPixel();
+		if (lhs.format() == rhs.format() && std::memcmp(lhs.row(y) + x * step, rhs.row(y) + x * step, count * step) == 0)
+			return true;
+		for (size_t i = x; i < x + count; i++) {
+			auto const p = lhs.at(i, y);
+			auto const q = rhs.at(i, y);
+			if (p.r != q.r || p.g != q.g || p.b != q.b)
+				return false;
+		}
+		return true;
+	}
+
+	//Smallest rectangle holding every pixel that differs from the previous frame. Frames that don't differ at all
+	//still need an image, they get the top left pixel. Frames of another size are dirty everywhere.
+	auto dirtyRegion(pixelView const& previous, pixelView const& current) -> region {
+		auto const width = current.width();
+		auto const height = current.height();
+		auto const full = region{ 0, 0, uint16_t(width), uint16_t(height) };
+		if (previous.width() != width || previous.height() != height || current.size() == 0)
+			return full;
+
+		size_t top = 0;
+		while (top < height && samePixels(previous, current, 0, top, width))
+			top++;
+		if (top == height)
+			return region{ 0, 0, 1, 1 };
+
+		size_t bottom = height - 1;
+		while (samePixels(previous, current, 0, bottom, width))
+			bottom--;
+
+		//Each row only has to be looked at up to the edges found so far. Some row in range is dirty,
+		//so left can't stay above its dirty column nor right below it.
+		size_t left = width - 1;
+		size_t right = 0;
+		for (size_t y = top; y <= bottom; y++) {
+			for (size_t x = 0; x < left; x++) {
+				if (!samePixels(previous, current, x, y, 1)) {
+					left = x;
+					break;
+				}
+			}
+			for (size_t x = width - 1; x > right; x--) {
+				if (!samePixels(previous, current, x, y, 1)) {
+					right = x;
+					break;
+				}
+			}
+		}
+
+		return region{ uint16_t(left), uint16_t(top), uint16_t(right - left + 1), uint16_t(bottom - top + 1) };
+	}
+
+	auto dirtyRegion(std::vector<RGBpixel> const& previous, std::vector<RGBpixel> const& current, uint16_t const width, uint16_t const height) -> region {
+		auto const size = size_t(width) * size_t(height);
+		if (previous.size() != size || current.size() != size)
+			return region{ 0, 0, width, height };
+		return dirtyRegion(pixelView(previous, width, height), pixelView(current, width, height));
+	}
+
+	//Multiply and rotate over 8 bytes at a time, enough to tell frames apart before comparing them for real.
+	//Row padding is left out but alpha isn't, frames that only differ in alpha just get compared in full.
+	auto frameHash(pixelView const& pixels) -> uint64_t {
+		auto const rowBytes = pixels.width() * pixels.bytesPerPixel();
+
+		uint64_t hash = 0x9E3779B97F4A7C15ull ^ (rowBytes * pixels.height());
+		auto const mix = [&hash](uint64_t const word) {
+			hash = (hash ^ word) * 0xBF58476D1CE4E5B9ull;
+			hash = (hash << 31) | (hash >> 33);
+		};
+
+		for (size_t y = 0; y < pixels.height(); y++) {
+			auto const* const bytes = pixels.row(y);
+			size_t i = 0;
+			for (; i + 8 <= rowBytes; i += 8) {
+				uint64_t word;
+				std::memcpy(&word, bytes + i, 8);
+				mix(word);
+			}
+			if (i < rowBytes) {
+				uint64_t tail = 0;
+				std::memcpy(&tail, bytes + i, rowBytes - i);
+				mix(tail);
+			}
+		}
+		return hash ^ (hash >> 29);
+	}
+
+	//True when no channel of any pixel is further apart than tolerance
+	auto similarFrames(pixelView const& lhs, pixelView const& rhs, uint8_t const tolerance) -> bool {
+		if (lhs.width() != rhs.width() || lhs.height() != rhs.height())
+			return false;
+
+		auto const close = [tolerance](uint8_t const a, uint8_t const b) {
+			return (a > b ? a - b : b - a) <= tolerance;
+		};
+		for (size_t y = 0; y < lhs.height(); y++) {
+			if (tolerance == 0) {
+				if (!samePixels(lhs, rhs, 0, y, lhs.width()))
+					return false;
+				continue;
+			}
+			for (size_t x = 0; x < lhs.width(); x++) {
+				auto const p = lhs.at(x, y);
+				auto const q = rhs.at(x, y);
+				if (!close(p.r, q.r) || !close(p.g, q.g) || !close(p.b, q.b))
+					return false;
+			}
+		}
+		return true;
+	}
+
+	//Swaps the indices of pixels inside area that are the same as in the previous frame for the transparent index
+	void maskUnchanged(pixelView const& previous, pixelView const& current, region const& area, std::vector<byte>& indices, uint8_t const transparent) {
+		if (previous.width() != current.width() || previous.height() != current.height())
+			return;
+		for (size_t y = 0; y < area.height; y++) {
+			for (size_t x = 0; x < area.width; x++) {
+				auto const p = previous.at(area.left + x, area.top + y);
+				auto const c = current.at(area.left + x, area.top + y);
+				if (p.r == c.r && p.g == c.g && p.b == c.b)
+					indices[y * area.width + x] = byte(transparent);
+			}
+		}
+	}
+
+	constexpr bool collectStats = GIF_STATS != 0;
+
+	//Rare events in one LZW stream. The clear code every stream starts with is counted.
+	struct lzwStats {
+		size_t clearCodes = 0;
+		size_t dictionaryFills = 0;
+
+		void add(lzwStats const& other) {
+			clearCodes += other.clearCodes;
+			dictionaryFills += other.dictionaryFills;
+		}
+	};
+
+	//What an encoder spent its time and memory on, attached with setStats and only filled in when GIF_STATS is 1.
+	//Stage times are summed over every thread that worked on the stage, so with threads they can add up to more than elapsedMs.
+	struct encodeStats {
+		enum stage : size_t {
+			analysis,		//Duplicate detection and dirty rectangles
+			quantization,	//Palettes built while encoding, the one a constructor builds happens before stats can be attached
+			mapping,		//Search structures, pixels to indices and transparency masking
+			compression,	//LZW over the index streams
+			framing,		//Sub-blocks, headers and tables written to the output
+			stages
+		};
+
+		struct time {
+			double wallMs = 0;
+			double cpuMs = 0;
+
+			void add(time const& other) {
+				wallMs += other.wallMs;
+				cpuMs += other.cpuMs;
+			}
+		};
+
+		//index is the frame's position as it was handed in, dropped duplicates don't get an entry
+		struct frame {
+			size_t index = 0;
+			size_t pixels = 0;
+			size_t paletteSize = 0;
+			size_t compressedBytes = 0;
+			lzwStats lzw;
+			std::array<time, stages> times{};
+		};
+
+		std::array<time, stages> times{};
+		std::vector<frame> frames;
+		lzwStats lzw;
+		size_t paletteSize = 0;
+		size_t peakBufferBytes = 0;
+		double elapsedMs = 0;
+
+		void clear() {
+			times = {};
+			frames.clear();
+			lzw = {};
+			paletteSize = 0;
+			peakBufferBytes = 0;
+			elapsedMs = 0;
+		}
+	};
+
+	//CPU time of the calling thread in milliseconds
+	auto threadCpuMs() -> double {
+#if GIF_STATS && defined(_WIN32)
+		FILETIME created, exited, kernel, user;
+		GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user);
+		auto const ticks = [](FILETIME const& t) {
+			return (uint64_t(t.dwHighDateTime) << 32) | t.dwLowDateTime;
+		};
+		return double(ticks(kernel) + ticks(user)) / 1e4;
+#elif GIF_STATS
+		timespec now{};
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+		return double(now.tv_sec) * 1e3 + double(now.tv_nsec) / 1e6;
+#else
+		return 0;
+#endif
+	}
+
+	//Adds the wall and CPU time between construction and destruction to a stage on the calling thread.
+	//Without GIF_STATS or without a target it does nothing.
+	class stageClock {
+	private:
+		encodeStats::time* into = nullptr;
+		std::chrono::steady_clock::time_point wallStart;
+		double cpuStart = 0;
+
+	public:
+		explicit stageClock(encodeStats::time* const target) {
+			if constexpr (collectStats) {
+				into = target;
+				if (into) {
+					wallStart = std::chrono::steady_clock::now();
+					cpuStart = threadCpuMs();
+				}
+			}
+		}
+
+		stageClock(stageClock const&) = delete;
+		auto operator=(stageClock const&) -> stageClock& = delete;
+
+		~stageClock() {
+			if constexpr (collectStats) {
+				if (into) {
+					into->wallMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+					into->cpuMs += threadCpuMs() - cpuStart;
+				}
+			}
+		}
+	};
+
+	class encoder {
+	private:
+		header signature;
+		screenDescriptor screen;
+		std::optional<colorTable> GCT;
+		std::optional<applicationExtensionLoop> loop;
+		std::vector<std::tuple<
+			imageDescriptor,
+			std::optional<colorTable>,
+			pixelView,
+			std::optional<graphicControlExtension>>
+			>descriptors;
+
+		trailer end;
+		dictionaryPolicy dictionary = dictionaryPolicy::adaptive;
+		compressionLevel effort = compressionLevel::fast;
+		uint32_t lossy = 0;
+		bool interlace = false;
+		size_t threads = 1;
+		size_t strips = 1;
+		colorMapping mapping = colorMapping::exact;
+		quantizer quantization = quantizer::medianCut;
+		localColorTables localTables = localColorTables::never;
+		double errorPerByte = 1000;
+		bool deltaFrames = false;
+		bool masking = false;
+		std::optional<uint8_t> duplicateTolerance;
+
+		//Entries of the global palette pixels may map to, a caller's palette is filled up behind them
+		size_t paletteColors = 256;
+
+		//Scratch for write(), kept between calls and through reset() so the next file reuses the memory
+		std::vector<size_t> kept;
+		std::vector<uint64_t> hashes;
+		std::vector<pixelView> areas;
+		std::vector<std::vector<byte>> indices;
+		std::vector<std::optional<std::pair<std::vector<byte>, size_t>>> compressed;
+
+		//Descriptor and local table each frame goes out with in this write(). Regions, flags and the tables the encoder
+		//picks only live here, descriptors keeps what the caller set so the next write() starts from that again.
+		std::vector<std::optional<imageDescriptor>> frameDescriptors;
+		std::vector<std::optional<colorTable>> frameTables;
+
+		//Search structures for the global palette, only rebuilt when the palette or the mapping settings change.
+		//mappedFor is the part of the palette pixels may map to, without the transparent entry.
+		std::vector<RGBpixel> mappedFor;
+		colorMapping mappedWith = colorMapping::exact;
+		std::optional<inverseColorMap> globalLookup;
+		std::optional<paletteSearch> globalSearch;
+
+		encodeStats* stats = nullptr;
+
+		//Where a stage of the whole encode, or of one entry of stats->frames, adds its time
+		auto statsTime(encodeStats::stage const s) const -> encodeStats::time* {
+			return collectStats && stats ? &stats->times[s] : nullptr;
+		}
+
+		auto statsTime(size_t const frame, encodeStats::stage const s) const -> encodeStats::time* {
+			return collectStats && stats ? &stats->frames[frame].times[s] : nullptr;
+		}
+
+		//LZW over the index stream, every code is handed to emit along with the width a decoder reads it at.
+		//Above compressionLevel::fast the strings are picked by one step of lookahead, flexible parsing, which any
+		//decoder follows since every prefix of a string in the table is in the table as well. With the table full it
+		//gives the fewest codes possible. With loose set the parse is greedy but lossy, see encoder::setLossy.
+		//in is anything that hands out indices with [], a pointer or an interlacedIndices.
+		//A stream that continues after this piece ends on a clear code instead of the end code, one that
+		//continues a previous piece skips the leading clear code since that one already reset the decoder.
+		//Returns the highest code that was ever assigned, counts gets the clear codes and full dictionaries on top.
+		template<typename Indices, typename Emit>
+		auto lzw_codes(Indices const& in, size_t const size, size_t const colorTableBits, dictionaryPolicy const policy, compressionLevel const level,
+			Emit&& emit, bool const first = true, bool const last = true, lzwStats* const counts = nullptr, lossyTarget const* const loose = nullptr) -> uint16_t {
+			uint16_t const clearCode = uint16_t(1) << colorTableBits;
+			uint16_t const end_of_info = clearCode + 1;
+			uint16_t const maxCode = 4096;
+			size_t const checkGap = 10000; //Same interval compress(1) checks its ratio at
+
+			size_t codeBits = colorTableBits + 1;
+			uint16_t nextCode = end_of_info + 1;
+			uint16_t highestCode = end_of_info;
+
+			//Single indices are implicit codes, only extended strings live in the table.
+			//One table per thread serves every call, clearing it costs as much as building it but doesn't allocate.
+			thread_local codeTable table;
+			table.clear();
+			//Codes of the prefixes of the string found at a position for lookahead, and a table to try a clear with
+			thread_local std::array<uint16_t, maxCode + 1> prefixes;
+			thread_local codeTable trial;
+
+			//Running ratio of input indices per output bit since the last clear code
+			size_t bitsSinceClear = 0;
+			size_t clearedAt = 0;
+			size_t checkedAt = 0;
+			double bestRatio = 0;
+
+			//The decoder widens after reading a code once its next free slot no longer fits
+			auto const put = [&](uint16_t const code) {
+				emit(code, codeBits);
+				bitsSinceClear += codeBits;
+				if (nextCode >= (uint16_t(1) << codeBits) && codeBits < 12)
+					codeBits++;
+			};
+
+			auto const reset = [&](size_t const at) {
+				if constexpr (collectStats) {
+					if (counts)
+						counts->clearCodes++;
+				}
+				put(clearCode);
+				table.clear();
+				nextCode = end_of_info + 1;
+				codeBits = colorTableBits + 1;
+				bitsSinceClear = 0;
+				clearedAt = at;
+				checkedAt = at;
+				bestRatio = 0;
+			};
+
+			if (first) {
+				if constexpr (collectStats) {
+					if (counts)
+						counts->clearCodes++;
+				}
+				put(clearCode);
+			}
+
+			//Length of the longest string in the table starting at in[at], prefixes gets the code of every prefix of it
+			auto const longest = [&](size_t const at, bool const record) -> size_t {
+				uint16_t key = uint16_t(in[at]);
+				if (record)
+					prefixes[1] = key;
+				size_t length = 1;
+				while (at + length < size) {
+					auto const found = table.find(key, uint16_t(in[at + length]));
+					if (!found)
+						break;
+					key = found.value();
+					length++;
+					if (record)
+						prefixes[length] = key;
+				}
+				return length;
+			};
+
+			//Bits for in[from, to) going on with the full table, and after a clear code with a new one.
+			//Both are parsed greedily, the comparison is all that matters.
+			auto const clearPays = [&](size_t const from, size_t const to) -> bool {
+				size_t frozen = 0;
+				for (size_t at = from; at < to; at += longest(at, false))
+					frozen += 12;
+
+				trial.clear();
+				size_t fresh = 12;
+				size_t width = colorTableBits + 1;
+				uint16_t code = end_of_info + 1;
+				uint16_t key = uint16_t(in[from]);
+				for (size_t at = from + 1; at < to && fresh < frozen; at++) {
+					auto const next = uint16_t(in[at]);
+					if (auto const found = trial.find(key, next); found) {
+						key = found.value();
+						continue;
+					}
+					fresh += width;
+					if (code >= (uint16_t(1) << width) && width < 12)
+						width++;
+					if (code < maxCode)
+						trial.insert(key, next, code++);
+					key = next;
+				}
+				return fresh + width < frozen;
+			};
+
+			//The string behind key followed by next becomes a code, unless the table is full
+			auto const extend = [&](uint16_t const key, uint16_t const next, size_t const i) {
+				if (nextCode < maxCode) {
+					table.insert(key, next, nextCode);
+					highestCode = std::max(highestCode, nextCode);
+					nextCode++;
+					if constexpr (collectStats) {
+						if (counts && nextCode == maxCode)
+							counts->dictionaryFills++;
+					}
+				}
+				else if (level == compressionLevel::best) {
+					//Tried as soon as the table fills up and then at the same intervals as the ratio
+					if (checkedAt == clearedAt || i - checkedAt >= checkGap) {
+						if (clearPays(i, std::min(size, i + checkGap)))
+							reset(i);
+						else
+							checkedAt = i;
+					}
+				}
+				else if (policy == dictionaryPolicy::clear) {
+					reset(i);
+				}
+				else if (policy == dictionaryPolicy::adaptive && i - checkedAt >= checkGap) {
+					auto const ratio = double(i - clearedAt) / double(bitsSinceClear);
+					if (ratio < bestRatio) {
+						reset(i);
+					}
+					else {
+						bestRatio = ratio;
+						checkedAt = i;
+					}
+				}
+			};
+
+			auto const checked = [clearCode](byte const b) -> uint16_t {
+				if (uint16_t(b) >= clearCode)
+					throw std::out_of_range("Index outside of the colortable");
+				return uint16_t(b);
+			};
+
+			if (size != 0 && loose) {
+				//A pixel may continue the string with any entry within maxError of its color, the one nearest to the
+				//color plus the error spread to it so far. A new string starts on the exact index, dithering there only
+				//adds noise that breaks the next matches. What the choice misses by is spread Floyd-Steinberg style
+				//over the pixels still to come, for an interlaced image the next row stored rather than the one below.
+				auto const& palette = *loose->palette;
+				auto const& pixels = loose->pixels;
+				auto const width = std::max(pixels.width(), size_t(1));
+				thread_local std::vector<std::array<int, 3>> spread;
+				spread.assign(2 * (width + 2), std::array<int, 3>{});
+
+				uint16_t currentKey = 0;
+				for (size_t i = 0; i < size; i++) {
+					auto const exact = checked(in[i]);
+					auto const x = i % width;
+					auto const y = i / width;
+					auto* const here = spread.data() + (y & 1) * (width + 2) + 1;
+					auto* const below = spread.data() + ((y + 1) & 1) * (width + 2) + 1;
+					if (x == 0)
+						std::fill(below - 1, below + width + 1, std::array<int, 3>{});
+
+					auto chosen = exact;
+					std::optional<uint16_t> continued;
+					if (palette.transparent == exact) {
+						if (i > 0)
+							continued = table.find(currentKey, exact);
+					}
+					else {
+						auto const stored = loose->firstRow + y;
+						auto const pixel = pixels.at(x, loose->interlaced ? interlacedRow(stored, pixels.height()) : stored);
+						auto const target = RGBpixel{
+							uint8_t(std::clamp(pixel.r + here[x][0], 0, 255)),
+							uint8_t(std::clamp(pixel.g + here[x][1], 0, 255)),
+							uint8_t(std::clamp(pixel.b + here[x][2], 0, 255)) };
+						auto nearest = INT_MAX;
+						for (auto const candidate : palette.near[exact]) {
+							auto const& color = palette.colors[candidate];
+							if (candidate != exact && lossyPalette::distance(pixel, color) > palette.limit)
+								continue;
+							auto const found = i > 0 ? table.find(currentKey, candidate) : std::nullopt;
+							auto const d = lossyPalette::distance(target, color);
+							if ((found && !continued) || (found && d < nearest)) {
+								chosen = candidate;
+								continued = found;
+								nearest = d;
+							}
+						}
+
+						auto const& shown = palette.colors[chosen];
+						int const error[3] = { target.r - shown.r, target.g - shown.g, target.b - shown.b };
+						for (size_t c = 0; c < 3; c++) {
+							here[x + 1][c] += error[c] * 7 / 16;
+							below[x - 1][c] += error[c] * 3 / 16;
+							below[x][c] += error[c] * 5 / 16;
+							below[x + 1][c] += error[c] / 16;
+						}
+					}
+
+					if (i == 0) {
+						currentKey = chosen;
+						continue;
+					}
+					if (continued) {
+						currentKey = continued.value();
+						continue;
+					}
+					put(currentKey);
+					extend(currentKey, chosen, i);
+					currentKey = chosen;
+				}
+				put(currentKey);
+			}
+			else if (size != 0 && level == compressionLevel::fast) {
+				uint16_t currentKey = checked(in[0]);
+				//A run at a time, so reading through a row order costs a lookup per row and not per index
+				for (size_t i = 1; i < size;) {
+					auto const [run, length] = runAt(in, i, size);
+					for (size_t j = 0; j < length; j++, i++) {
+						auto const next = checked(run[j]);
+
+						if (auto const found = table.find(currentKey, next); found) {
+							currentKey = found.value();
+							continue;
+						}
+
+						put(currentKey);
+						extend(currentKey, next, i);
+						currentKey = next;
+					}
+				}
+				//End of pixels, final key
+				put(currentKey);
+			}
+			else if (size != 0) {
+				for (size_t i = 0; i < size; i++)
+					checked(in[i]);
+
+				for (size_t i = 0; i < size;) {
+					auto const length = longest(i, true);
+					//Greedy unless a shorter string lets the one after it end further on, ties keep the longer one
+					auto take = length;
+					if (nextCode == maxCode && length > 1 && i + length < size) {
+						auto reach = length + longest(i + length, false);
+						for (size_t shorter = length - 1; shorter > 0; shorter--) {
+							auto const candidate = shorter + longest(i + shorter, false);
+							if (candidate > reach) {
+								reach = candidate;
+								take = shorter;
+							}
+						}
+					}
+
+					put(prefixes[take]);
+					i += take;
+					if (i < size)
+						extend(prefixes[take], uint16_t(in[i]), i);
+				}
+			}
+			if constexpr (collectStats) {
+				if (counts && !last)
+					counts->clearCodes++;
+			}
+			put(last ? end_of_info : clearCode);
+
+			return highestCode;
+		}
+
+		//The bit stream of lzw_codes at this encoder's level, along with its length in bits.
+		//compressionLevel::best also tries the dictionary policy instead of the cost based clears and keeps the shorter
+		//stream, a trial over the next stretch can't tell how long a full table stays useful.
+		template<typename Indices>
+		auto lzw_stream(Indices const& in, size_t const size, size_t const colorTableBits, dictionaryPolicy const policy, std::vector<byte> storage,
+			bool const first, bool const last, lzwStats* const counts, lossyTarget const* const loose) -> std::pair<std::vector<byte>, size_t> {
+			auto const run = [&](compressionLevel const level, std::vector<byte> memory, lzwStats* const runCounts) {
+				bitWriter writer(std::move(memory), size);
+				lzw_codes(in, size, colorTableBits, policy, level, [&writer](uint16_t const code, size_t const width) {
+					writer.write(code, width);
+					}, first, last, runCounts, loose);
+				auto const bits = writer.bits();
+				return std::pair{ writer.finish(), bits };
+			};
+			if (effort != compressionLevel::best)
+				return run(effort, std::move(storage), counts);
+
+			lzwStats byCost, byPolicy;
+			auto costed = run(compressionLevel::best, std::move(storage), &byCost);
+			auto policed = run(compressionLevel::lookahead, {}, &byPolicy);
+			auto const cheaper = policed.second < costed.second;
+			if constexpr (collectStats) {
+				if (counts)
+					counts->add(cheaper ? byPolicy : byCost);
+			}
+			return cheaper ? std::move(policed) : std::move(costed);
+		}
+
+		void restart(uint16_t const width, uint16_t const height, std::vector<pixelView> const& frames, bool const looping) {
+			screen = screenDescriptor(width, height);
+			if (!looping)
+				loop.reset();
+			else if (!loop)
+				loop.emplace();
+			descriptors.clear();
+			addViews(width, height, frames);
+		}
+
+		void addViews(uint16_t const width, uint16_t const height, std::vector<pixelView> const& frames) {
+			for (auto const& frame : frames) {
+				if (frame.width() != width || frame.height() != height)
+					throw std::invalid_argument("Frame does not cover the screen");
+				descriptors.emplace_back(std::tuple{ imageDescriptor(width,height),std::nullopt,frame,std::nullopt });
+			}
+		}
+
+	public:
+		//TODO: imagedescriptor, image data, support for multiple images in constructor
+		encoder(uint16_t width, uint16_t height, std::vector<RGBpixel> const& pixels, quantizer const palette = quantizer::medianCut) : screen(width, height),
+			descriptors{ std::tuple{imageDescriptor(width,height),std::nullopt, pixelView::copyOf(pixels, width, height), std::nullopt} },
+			GCT(colorTable(quantize(pixels, palette))), quantization(palette) {};
+
+		encoder(uint16_t width, uint16_t height, std::vector<std::vector<RGBpixel>> const& pixels, bool looping = true, quantizer const palette = quantizer::medianCut) : screen(width, height),
+			GCT(colorTable(quantize(pixels[0], palette))), quantization(palette) {
+			if (looping)
+				loop = applicationExtensionLoop();
+			for (size_t i = 0; i < pixels.size(); i++) {
+				descriptors.emplace_back(std::tuple{ imageDescriptor(width,height),std::nullopt,pixelView::copyOf(pixels[i], width, height),std::nullopt });
+			}
+		};
+
+		//Palette decided by the caller, for example by globalPalette over every frame. The screen descriptor always announces 256 colors.
+		encoder(uint16_t width, uint16_t height, std::vector<std::vector<RGBpixel>> const& pixels, colorTable const& palette, bool looping = true) :
+			screen(width, height), GCT(fillPalette(palette.table)), paletteColors(std::min(palette.table.size(), size_t(256))) {
+			if (looping)
+				loop = applicationExtensionLoop();
+			for (size_t i = 0; i < pixels.size(); i++) {
+				descriptors.emplace_back(std::tuple{ imageDescriptor(width,height),std::nullopt,pixelView::copyOf(pixels[i], width, height),std::nullopt });
+			}
+		};
+
+		//Frames are read straight from the caller's buffers, which have to stay alive until write() returns
+		encoder(uint16_t width, uint16_t height, std::vector<pixelView> const& frames, bool looping = true, quantizer const palette = quantizer::medianCut) :
+			screen(width, height), quantization(palette) {
+			if (frames.empty())
+				throw std::invalid_argument("No frames");
+			if (looping)
+				loop = applicationExtensionLoop();
+			addViews(width, height, frames);
+			GCT.emplace(quantize(frames[0], palette));
+		};
+
+		encoder(uint16_t width, uint16_t height, std::vector<pixelView> const& frames, colorTable const& palette, bool looping = true) :
+			screen(width, height), GCT(fillPalette(palette.table)), paletteColors(std::min(palette.table.size(), size_t(256))) {
+			if (looping)
+				loop = applicationExtensionLoop();
+			addViews(width, height, frames);
+		};
+
+		encoder() = default;
+
+		//Starts over with new frames for the next file. Settings stay, and so does the memory the last write() used,
+		//which is what keeps a long running encoder from allocating. Frames come without delays, like in a new encoder.
+		void reset(uint16_t width, uint16_t height, std::vector<pixelView> const& frames, bool looping = true) {
+			if (frames.empty())
+				throw std::invalid_argument("No frames");
+			restart(width, height, frames, looping);
+			stageClock timing(statsTime(encodeStats::quantization));
+			GCT.emplace(quantize(frames[0], quantization));
+			paletteColors = 256;
+		}
+
+		//A palette equal to the one before keeps its search structures
+		void reset(uint16_t width, uint16_t height, std::vector<pixelView> const& frames, colorTable const& palette, bool looping = true) {
+			restart(width, height, frames, looping);
+			auto const colors = std::min(palette.table.size(), size_t(256));
+			auto const* const current = GCT ? &GCT.value().table : nullptr;
+			auto const equal = [](RGBpixel const& lhs, RGBpixel const& rhs) {
+				return lhs.r == rhs.r && lhs.g == rhs.g && lhs.b == rhs.b;
+			};
+			//Compared in place against what fillPalette would make, so a steady palette allocates nothing
+			auto const same = colors != 0 && current && current->size() == 256 &&
+				std::equal(palette.table.begin(), palette.table.begin() + ptrdiff_t(colors), current->begin(), equal) &&
+				std::all_of(current->begin() + ptrdiff_t(colors), current->end(), [&](RGBpixel const& p) {
+					return equal(p, palette.table[colors - 1]);
+					});
+			if (!same)
+				GCT.emplace(fillPalette(palette.table));
+			paletteColors = colors;
+		}
+
+		//This function returns a std::bitset<N> by design where N is the amount of bits needed to store colortable+clearcode+stopcode+generated codes
+		//bitset size can't be determined just based on the function input since it depends on the pixels how many codes are generated in the table
+		//a lower bound can be determined though based on the size of the colortable
+		auto lzw_encode(std::vector<byte> const& in, size_t const colorTableBits, dictionaryPolicy const policy = dictionaryPolicy::adaptive) -> lzw_code {
+			std::vector<uint16_t> out;
+			auto const highestCode = lzw_codes(in.data(), in.size(), colorTableBits, policy, effort, [&out](uint16_t const code, size_t) {
+				out.push_back(code);
+				});
+
+			//Biggest key we needed
+			auto const bitsUsed = [](uint16_t const n) -> size_t {
+				std::bitset<14> highest = n;
+				for (size_t i = highest.size() - 1; i > 1; i--) {
+					if (highest.test(i))
+						return i + 1;
+				}
+				return 2;
+
+			}(highestCode);
+
+			lzw_code res;
+
+			switch (bitsUsed) {
+			case 2:
+			{
+				res = toBitset<2>(out);
+				break;
+			}
+			case 3:
+			{
+				res = toBitset<3>(out);
+				break;
+			}
+			case 4:
+			{
+				res = toBitset<4>(out);
+				break;
+			}
+			case 5:
+			{
+				res = toBitset<5>(out);
+				break;
+			}
+			case 6:
+			{
+				res = toBitset<6>(out);
+				break;
+			}
+			case 7:
+			{
+				res = toBitset<7>(out);
+				break;
+			}
+			case 8:
+			{
+				res = toBitset<8>(out);
+				break;
+			}
+			case 9:
+			{
+				res = toBitset<9>(out);
+				break;
+			}
+			case 10:
+			{
+				res = toBitset<10>(out);
+				break;
+			}
+			case 11:
+			{
+				res = toBitset<11>(out);
+				break;
+			}
+			case 12:
+			{
+				res = toBitset<12>(out);
+				break;
+			}
+			case 13:
+			{
+				res = toBitset<13>(out);
+				break;
+			}
+			case 14:
+			{
+				res = toBitset<14>(out);
+				break;
+			}
+			}
+
+			return res;
+		}
+
+		//Same codes as lzw_encode but every code is written straight to the bit stream at the width
+		//the decoder expects at that point, starting at colorTableBits + 1 and growing up to 12 bits.
+		//The result is built in storage, handing back a previous result reuses its memory.
+		//loose makes it lossy, see setLossy.
+		auto lzw_compress(std::vector<byte> const& in, size_t const colorTableBits, dictionaryPolicy const policy = dictionaryPolicy::adaptive,
+			std::vector<byte> storage = {}, lzwStats* const counts = nullptr, lossyTarget const* const loose = nullptr) -> std::vector<byte> {
+			if (loose && loose->pixels.size() != in.size())
+				throw std::invalid_argument("Lossy target does not match the indices");
+			return lzw_stream(in.data(), in.size(), colorTableBits, policy, std::move(storage), true, true, counts, loose).first;
+		}
+
+		//Cuts the index stream into strips of whole rows that are compressed independently and then joined bit for bit.
+		//Each strip but the last ends on a clear code so the next one can start from an empty table wherever it lands.
+		//More strips means more parallelism, but every strip has to build its dictionary up from nothing again.
+		//Only the joined result goes into storage, the strips themselves still get memory of their own.
+		//Interlaced puts the rows in the order an interlaced image stores them, strips then cut that order.
+		auto lzw_compress_strips(std::vector<byte> const& in, size_t const colorTableBits, size_t const rowWidth, size_t const strips,
+			size_t const workers = 1, dictionaryPolicy const policy = dictionaryPolicy::adaptive, std::vector<byte> storage = {},
+			lzwStats* const counts = nullptr, lossyTarget const* const loose = nullptr, bool const interlaced = false) -> std::vector<byte> {
+			auto const width = std::max(rowWidth, size_t(1));
+			if (loose && (loose->pixels.size() != in.size() || loose->pixels.width() != width))
+				throw std::invalid_argument("Lossy target does not match the indices");
+			auto const rows = (in.size() + width - 1) / width;
+			auto const rowsPerStrip = std::max(size_t(1), (rows + std::max(strips, size_t(1)) - 1) / std::max(strips, size_t(1)));
+			auto const count = std::max(size_t(1), (rows + rowsPerStrip - 1) / rowsPerStrip);
+
+			std::vector<std::pair<std::vector<byte>, size_t>> parts(count);
+			std::vector<lzwStats> partCounts(collectStats && counts ? count : 0);
+			parallelFor(count, workers, [&](size_t const strip) {
+				auto const begin = std::min(in.size(), strip * rowsPerStrip * width);
+				auto const end = std::min(in.size(), (strip + 1) * rowsPerStrip * width);
+
+				//Each strip spreads its lossy error within its own rows
+				std::optional<lossyTarget> part;
+				if (loose)
+					part = lossyTarget{ loose->pixels, loose->palette, begin / width, interlaced };
+				auto memory = count == 1 ? std::move(storage) : std::vector<byte>();
+				auto* const partCount = partCounts.empty() ? nullptr : &partCounts[strip];
+				if (interlaced) {
+					parts[strip] = lzw_stream(interlacedIndices(in.data(), width, rows, begin), end - begin, colorTableBits, policy, std::move(memory),
+						strip == 0, strip + 1 == count, partCount, part ? &part.value() : nullptr);
+				}
+				else {
+					parts[strip] = lzw_stream(in.data() + begin, end - begin, colorTableBits, policy, std::move(memory),
+						strip == 0, strip + 1 == count, partCount, part ? &part.value() : nullptr);
+				}
+				});
+			for (auto const& part : partCounts)
+				counts->add(part);
+
+			if (count == 1)
+				return std::move(parts[0].first);
+
+			bitWriter joined(std::move(storage), in.size());
+			for (auto const& [bytes, bits] : parts)
+				joined.append(bytes, bits);
+			return joined.finish();
+		}
+
+		void setDictionaryPolicy(dictionaryPolicy const policy) {
+			dictionary = policy;
+		}
+
+		//Applies to every LZW call of this encoder, lzw_encode and lzw_compress included
+		void setCompressionLevel(compressionLevel const level) {
+			effort = level;
+		}
+
+		//Lets a pixel take another palette entry up to maxError away from its color, Euclidean in RGB, where that
+		//continues the LZW string. The error is diffused so gradients don't band, noisy gradients shrink the most.
+		//0 is lossless. The parse is greedy whatever the compression level.
+		void setLossy(uint32_t const maxError) {
+			lossy = maxError;
+		}
+
+		//Stores the rows of every frame pass by pass, so a viewer can show the whole frame roughly before all of it arrived.
+		//LZW reads the rows in that order in place, the frames aren't copied for it.
+		void setInterlaced(bool const enabled) {
+			interlace = enabled;
+		}
+
+		//Frames are mapped and compressed on this many threads, 0 picks one per core
+		void setThreads(size_t const count) {
+			threads = count != 0 ? count : std::max(size_t(1), size_t(std::thread::hardware_concurrency()));
+		}
+
+		//Splits every frame into this many independently compressed strips, see lzw_compress_strips
+		void setStrips(size_t const count) {
+			strips = std::max(count, size_t(1));
+		}
+
+		void setColorMapping(colorMapping const mode) {
+			mapping = mode;
+		}
+
+		//Frames after the first only cover the rectangle that changed since the previous one,
+		//the decoder keeps showing the rest of the previous frame
+		void setDeltaFrames(bool const enabled) {
+			deltaFrames = enabled;
+		}
+
+		//Every frame gets a graphic control extension with this delay
+		void setDelay(uint16_t const hundredths) {
+			for (auto& frame : descriptors) {
+				auto& control = std::get<3>(frame);
+				if (!control)
+					control.emplace();
+				control->setDelay(hundredths);
+			}
+		}
+
+		//Pixels that didn't change since the previous frame become transparent so the previous frame shows through.
+		//The last entry of every color table is given up for the transparent index.
+		void setTransparencyMasking(bool const enabled) {
+			masking = enabled;
+		}
+
+		//A frame that matches the last one written is dropped and its delay is added to that frame.
+		//tolerance is the largest channel difference still counted as a match, 0 only drops exact copies.
+		void setDropDuplicates(bool const enabled, uint8_t const tolerance = 0) {
+			duplicateTolerance = enabled ? std::optional<uint8_t>(tolerance) : std::nullopt;
+		}
+
+		//Everything from here on adds to stats, reset() and every write() included, clear them to look at one file at a time.
+		//nullptr stops recording, and nothing is recorded unless GIF_STATS is 1.
+		void setStats(encodeStats* const target) {
+			stats = target;
+		}
+
+		//Frames without a palette of their own can get one, built with the same quantizer as the global palette.
+		//In adaptive mode a frame takes it when the squared error saved exceeds errorPerByte for every byte of the table.
+		void setLocalColorTables(localColorTables const mode, double const errorPerTableByte = 1000) {
+			localTables = mode;
+			errorPerByte = errorPerTableByte;
+		}
+
+		//Returns the compressed image data together with the LZW minimum code size.
+		//rowWidth lines the strips up with image rows, workers is how many threads the strips may use.
+		//storage is reused for the compressed data, see lzw_compress.
+		auto encode(std::vector<byte> const& in, size_t const colorTableBits, size_t const rowWidth = 0, size_t const workers = 1,
+			std::vector<byte> storage = {}, lzwStats* const counts = nullptr, lossyTarget const* const loose = nullptr,
+			bool const interlaced = false) -> std::optional<std::pair<std::vector<byte>, size_t>> {
+			if (strips > 1 || interlaced) {
+				return std::pair{ lzw_compress_strips(in, colorTableBits, rowWidth, strips, workers, dictionary, std::move(storage), counts, loose, interlaced),
+					colorTableBits };
+			}
+			return std::pair{ lzw_compress(in, colorTableBits, dictionary, std::move(storage), counts, loose), colorTableBits };
+		}
+
+		//Fills kept with the frames that get written.
+		//Near duplicates are compared with the last kept frame so slow fades can't creep by.
+		void selectFrames() {
+			stageClock timing(statsTime(encodeStats::analysis));
+			kept.clear();
+			if (!duplicateTolerance) {
+				kept.resize(descriptors.size());
+				std::iota(kept.begin(), kept.end(), size_t(0));
+				return;
+			}
+
+			auto const tolerance = duplicateTolerance.value();
+			hashes.assign(descriptors.size(), 0);
+			if (tolerance == 0) {
+				parallelFor(descriptors.size(), threads, [&](size_t const i) {
+					hashes[i] = frameHash(std::get<2>(descriptors[i]));
 					});
+			}
+
+			for (size_t i = 0; i < descriptors.size(); i++) {
+				if (!kept.empty() && hashes[i] == hashes[kept.back()] &&
+					similarFrames(std::get<2>(descriptors[kept.back()]), std::get<2>(descriptors[i]), tolerance))
+					continue;
+				kept.push_back(i);
+			}
+		}
+
+		//Builds whichever search the global palette needs unless the one from the last write() still fits
+		void prepareGlobalMapping(bool const lookup) {
+			stageClock timing(statsTime(encodeStats::mapping));
+			auto const& table = GCT.value().table;
+			auto const usable = std::min(masking ? table.size() - 1 : table.size(), paletteColors);
+			auto const same = mappedWith == mapping && std::equal(mappedFor.begin(), mappedFor.end(), table.begin(), table.begin() + usable,
+				[](RGBpixel const& lhs, RGBpixel const& rhs) {
+					return lhs.r == rhs.r && lhs.g == rhs.g && lhs.b == rhs.b;
+				});
+			if (!same) {
+				mappedFor.assign(table.begin(), table.begin() + usable);
+				mappedWith = mapping;
+				globalLookup.reset();
+				globalSearch.reset();
+			}
+
+			if (lookup && !globalLookup)
+				globalLookup.emplace(colorTable(mappedFor), mapping);
+			if (!lookup && !globalSearch)
+				globalSearch.emplace(colorTable(mappedFor));
+		}
+
+		//Once the palettes are fixed every frame can be mapped and compressed on its own, the results keep frame order.
+		//With fewer frames than threads and more than one strip per frame the spare threads go to the strips as well.
+		//Results for the frames in kept land in compressed, lined up with descriptors.
+		void compressFrames() {
+			compressed.resize(descriptors.size());
+			indices.resize(descriptors.size());
+			areas.resize(descriptors.size());
+			frameDescriptors.resize(descriptors.size());
+			frameTables.resize(descriptors.size());
+
+			auto const frameWorkers = std::max(std::min(threads, kept.size()), size_t(1));
+			auto const stripWorkers = strips > 1 ? (threads + frameWorkers - 1) / frameWorkers : 1;
+
+			//Building an inverse colormap costs about as much as brute force mapping this many pixels
+			constexpr size_t lookupWorthIt = 65536;
+			auto const useLookup = [this](size_t const pixelCount) {
+				return mapping == colorMapping::approximate || pixelCount >= lookupWorthIt;
+			};
+
+			auto const firstStat = collectStats && stats ? stats->frames.size() : 0;
+			if (collectStats && stats)
+				stats->frames.resize(firstStat + kept.size());
+
+			//Regions come first since only their pixels get mapped, they are views into the frames rather than copies
+			auto const screenSize = screen.dimensions();
+			parallelFor(kept.size(), threads, [&](size_t const k) {
+				stageClock timing(statsTime(firstStat + k, encodeStats::analysis));
+				auto const i = kept[k];
+				auto const& pixels = std::get<2>(descriptors[i]);
+				auto const area = deltaFrames && k > 0 ?
+					dirtyRegion(std::get<2>(descriptors[kept[k - 1]]), pixels) :
+					region{ 0, 0, screenSize.first, screenSize.second };
+				frameDescriptors[i].emplace(std::get<0>(descriptors[i]));
+				frameDescriptors[i].value().setRegion(area);
+				if (auto const& given = std::get<1>(descriptors[i]); given)
+					frameTables[i].emplace(given.value());
+				else
+					frameTables[i].reset();
+				areas[i] = pixels.sub(area);
+				});
+
+			size_t globalPixels = 0;
+			for (auto const i : kept) {
+				if (!frameTables[i])
+					globalPixels += areas[i].size();
+			}
+
+			//With masking nothing may map to the last entry, it is the transparent index
+			auto const opaque = [this](colorTable const& table) {
+				return masking ? colorTable(std::vector<RGBpixel>(table.table.begin(), table.table.end() - 1)) : table;
+			};
+
+			auto const lookupGlobal = useLookup(globalPixels);
+			if (GCT)
+				prepareGlobalMapping(lookupGlobal);
+
+			parallelFor(kept.size(), frameWorkers, [&](size_t const k) {
+				auto const i = kept[k];
+				auto& desc = frameDescriptors[i].value();
+				auto& localTable = frameTables[i];
+				auto const& pixels = areas[i];
+				auto* table = localTable ? &localTable.value() : (GCT ? &GCT.value() : nullptr);
+
+				//we need a table after all
+				if (table == nullptr) {
+					compressed[i].reset();
+					return;
+				}
+
+				auto const mapLocal = [&](colorTable const& local) {
+					auto const usable = opaque(local);
+					return useLookup(pixels.size()) ? mapPixels(pixels, inverseColorMap(usable, mapping)) : mapPixels(pixels, usable);
+				};
+
+				std::optional<stageClock> timing;
+				timing.emplace(statsTime(firstStat + k, encodeStats::mapping));
+				auto& mapped = indices[i];
+				if (!localTable && GCT) {
+					mapped.resize(pixels.size());
+					if (lookupGlobal)
+						globalLookup.value().map(pixels, mapped.data());
+					else
+						globalSearch.value().map(pixels, mapped.data());
+				}
+				else {
+					mapped = mapLocal(*table);
+				}
+
+				if (!localTable && localTables != localColorTables::never) {
+					timing.emplace(statsTime(firstStat + k, encodeStats::quantization));
+					auto own = colorTable(quantize(pixels, quantization));
+					timing.emplace(statsTime(firstStat + k, encodeStats::mapping));
+					auto ownMapped = mapLocal(own);
+					auto const tableBytes = double(own.table.size() * 3);
+					if (localTables == localColorTables::always ||
+						double(mappingError(pixels, mapped, *table)) - double(mappingError(pixels, ownMapped, own)) > errorPerByte * tableBytes) {
+						desc.setLocalColor(own.bitsNeeded());
+						localTable.emplace(std::move(own));
+						table = &localTable.value();
+						mapped = std::move(ownMapped);
+					}
+				}
+
+				if (masking && k > 0)
+					maskUnchanged(std::get<2>(descriptors[kept[k - 1]]), std::get<2>(descriptors[i]), desc.area(), mapped, uint8_t(table->table.size() - 1));
+
+				timing.emplace(statsTime(firstStat + k, encodeStats::compression));
+				std::optional<lossyPalette> loosePalette;
+				std::optional<lossyTarget> loose;
+				if (lossy != 0) {
+					loosePalette.emplace(*table, lossy, masking ? std::optional<uint8_t>(uint8_t(table->table.size() - 1)) : std::nullopt);
+					loose = lossyTarget{ pixels, &loosePalette.value(), 0, interlace };
+				}
+				auto* const counts = collectStats && stats ? &stats->frames[firstStat + k].lzw : nullptr;
+				auto storage = compressed[i] ? std::move(compressed[i].value().first) : std::vector<byte>();
+				desc.setInterlaced(interlace);
+				compressed[i] = encode(mapped, table->bitsNeeded(), desc.dimensions().first, stripWorkers, std::move(storage), counts,
+					loose ? &loose.value() : nullptr, interlace);
+				timing.reset();
+
+				if (collectStats && stats) {
+					auto& frame = stats->frames[firstStat + k];
+					frame.paletteSize = table->table.size();
+					frame.compressedBytes = compressed[i].value().first.size();
+				}
+				});
+
+			if (collectStats && stats) {
+				for (size_t k = 0; k < kept.size(); k++) {
+					auto& frame = stats->frames[firstStat + k];
+					frame.index = kept[k];
+					frame.pixels = areas[kept[k]].size();
+					for (size_t stage = 0; stage < encodeStats::stages; stage++)
+						stats->times[stage].add(frame.times[stage]);
+					stats->lzw.add(frame.lzw);
+				}
+			}
+		}
+
+		//With masking the last entry of the table a frame uses is its transparent index. It only goes into the
+		//extension written for this file, the frame's own one keeps what the caller set.
+		auto transparentIndex(size_t const frame) const -> std::optional<uint8_t> {
+			auto const& localTable = frameTables[frame];
+			auto const* const table = localTable ? &localTable.value() : (GCT ? &GCT.value() : nullptr);
+			if (!masking || table == nullptr)
+				return std::nullopt;
+			return uint8_t(table->table.size() - 1);
+		}
+
+		//Exact size of the file for what compressFrames left behind
+		auto fileSize() const -> size_t {
+			auto size = header::size + screenDescriptor::size + (GCT ? GCT.value().size() : 0) + (loop ? applicationExtensionLoop::size : 0) + 1;
+			for (auto const i : kept) {
+				auto const& control = std::get<3>(descriptors[i]);
+				auto const& localTable = frameTables[i];
+				auto const extension = control || transparentIndex(i);
+				size += (extension ? graphicControlExtension::size : 0) + imageDescriptor::size + (localTable ? localTable.value().size() : 0);
+				if (compressed[i])
+					size += imageDataSize(compressed[i].value().first.size());
+			}
+			return size;
+		}
+
+		//Encodes into out, replacing what it held. out only grows when it lacks the capacity, so a buffer reused
+		//between files stops allocating. Any contiguous byte container works, std::pmr::vector included.
+		template<typename Buffer>
+		auto writeTo(Buffer& out) -> size_t {
+			encodeStats::time elapsed;
+			std::optional<stageClock> timing;
+			timing.emplace(collectStats && stats ? &elapsed : nullptr);
+			selectFrames();
+			compressFrames();
+
+			std::optional<stageClock> framing;
+			framing.emplace(statsTime(encodeStats::framing));
+			out.clear();
+			auto writer = appendTo(out, fileSize());
+			signature.write(writer);
+			screen.write(writer);
+
+			if (GCT)
+				GCT.value().write(writer);
+
+			if (loop)
+				loop.value().write(writer);
+
+			for (size_t k = 0; k < kept.size(); k++) {
+				auto const i = kept[k];
+				auto const& control = std::get<3>(descriptors[i]);
+				auto const& localTable = frameTables[i];
+				auto const transparent = transparentIndex(i);
+				if (control || transparent) {
+					//Shown for as long as the frames dropped after it would have been
+					uint32_t delay = 0;
+					for (size_t j = i; j < (k + 1 < kept.size() ? kept[k + 1] : descriptors.size()); j++) {
+						if (auto const& dropped = std::get<3>(descriptors[j]); dropped)
+							delay += dropped.value().getDelay();
+					}
+					auto merged = control.value_or(graphicControlExtension());
+					merged.setDelay(uint16_t(std::min(delay, uint32_t(UINT16_MAX))));
+					merged.setTransparent(transparent);
+					merged.write(writer);
+				}
+				frameDescriptors[i].value().write(writer);
+
+				if (localTable)
+					localTable.value().write(writer);
+
+				if (!compressed[i].has_value())
+					continue;
+
+				auto const& [bytes, size] = compressed[i].value();
+				writeImageData(writer, bytes, size);
+			}
+			writer.put(end.trail);
+			framing.reset();
+			timing.reset();
+
+			if (collectStats && stats) {
+				//Every buffer is at its fullest once the file is written
+				auto held = out.capacity();
+				for (auto const i : kept) {
+					held += indices[i].capacity() + (compressed[i] ? compressed[i].value().first.capacity() : 0);
+				}
+				stats->paletteSize = GCT ? GCT.value().table.size() : 0;
+				stats->peakBufferBytes = std::max(stats->peakBufferBytes, held);
+				stats->elapsedMs += elapsed.wallMs;
+			}
+			return writer.size();
+		}
+
+		auto write() -> std::optional<std::vector<byte>> {
+			std::vector<byte> out;
+			writeTo(out);
+			return out;
+		}
+	};
+
+	//Encodes an animation frame by frame, everything is handed to the sink as soon as it is known.
+	//Only the frame currently being encoded is kept around so memory use doesn't depend on the length of the animation.
+	class streamEncoder {
+	public:
+		using sink = std::function<void(byte const* data, size_t size)>;
+
+	private:
+		sink out;
+		header signature;
+		screenDescriptor screen;
+		std::optional<colorTable> GCT;
+		std::optional<applicationExtensionLoop> loop;
+		trailer end;
+
+		uint16_t width = 0;
+		uint16_t height = 0;
+		bool started = false;
+		bool finished = false;
+
+		//Reused for every frame so the steady state doesn't allocate for output
+		std::vector<byte> buffer;
+		std::vector<byte> indices;
+		std::vector<byte> compressed;
+		encoder compressor;
+		size_t threads = 1;
+		quantizer quantization = quantizer::medianCut;
+
+		//Every frame shares the global palette so its inverse colormap is built once.
+		//It only holds the entries pixels may map to, a caller's palette is filled up behind them.
+		colorMapping mapping = colorMapping::exact;
+		std::optional<inverseColorMap> lookup;
+		size_t paletteColors = 256;
+
+		//Lossy LZW against the global palette, built with the inverse colormap
+		uint32_t lossy = 0;
+		std::optional<lossyPalette> loosePalette;
+		bool interlaced = false;
+
+		//Last frame as it was handed in, only kept while delta frames or masking are on
+		bool deltaFrames = false;
+		bool masking = false;
+		std::vector<RGBpixel> previous;
+		std::optional<graphicControlExtension> control;
+
+		encodeStats* stats = nullptr;
+		size_t added = 0;
+
+		//Where a stage of the frame being added adds its time
+		auto statsTime(encodeStats::stage const s) const -> encodeStats::time* {
+			return collectStats && stats ? &stats->frames.back().times[s] : nullptr;
+		}
+
+		void flush() {
+			if (!buffer.empty())
+				out(buffer.data(), buffer.size());
+			buffer.clear();
+		}
+
+		void start() {
+			auto writer = appendTo(buffer, header::size + screenDescriptor::size + (GCT ? GCT.value().size() : 0) + (loop ? applicationExtensionLoop::size : 0));
+			signature.write(writer);
+			screen.write(writer);
+
+			if (GCT)
+				GCT.value().write(writer);
+
+			if (loop)
+				loop.value().write(writer);
+			flush();
+			started = true;
+		}
+
+	public:
+		//The global palette is built from the first frame, same as the animated encoder does
+		streamEncoder(uint16_t width, uint16_t height, sink out, bool looping = true) :
+			out(std::move(out)), screen(width, height), width(width), height(height) {
+			if (looping)
+				loop = applicationExtensionLoop();
+		}
+
+		//Fixed palette, the header goes out right away. The screen descriptor always announces 256 colors.
+		streamEncoder(uint16_t width, uint16_t height, colorTable const& palette, sink out, bool looping = true) :
+			streamEncoder(width, height, std::move(out), looping) {
+			GCT.emplace(fillPalette(palette.table));
+			paletteColors = std::min(palette.table.size(), size_t(256));
+			start();
+		}
 
-				if (result != table.end()) {
-					currentKey = result->first;
-				}
-				else {
-					out.push_back(currentKey);
-					table[++compressionID] = hash;
+		void setDictionaryPolicy(dictionaryPolicy const policy) {
+			compressor.setDictionaryPolicy(policy);
+		}
 
-					//Initialize local string with suffix of old string
-					hash = std::vector{ hash.back() };
-					auto at = std::find_if(table.begin(), table.end(), [hash](auto const& kv) -> bool {
-						return kv.second == hash;
-						});
+		void setCompressionLevel(compressionLevel const level) {
+			compressor.setCompressionLevel(level);
+		}
 
-					if (at != table.end()) {
-						currentKey = at->first;
-					}
-					else {
-						throw std::exception("Impossible to hit this");
-					}
-				}
+		//See encoder::setLossy
+		void setLossy(uint32_t const maxError) {
+			lossy = maxError;
+			loosePalette.reset();
+		}
+
+		//See encoder::setInterlaced, applies from the next frame on
+		void setInterlaced(bool const enabled) {
+			interlaced = enabled;
+		}
+
+		//Frames go out one at a time, so threads only help together with strips
+		void setThreads(size_t const count) {
+			threads = count != 0 ? count : std::max(size_t(1), size_t(std::thread::hardware_concurrency()));
+		}
+
+		void setStrips(size_t const count) {
+			compressor.setStrips(count);
+		}
 
+		void setColorMapping(colorMapping const mode) {
+			mapping = mode;
+			lookup.reset();
+		}
+
+		//Frames after the first only cover the rectangle that changed, see encoder::setDeltaFrames
+		void setDeltaFrames(bool const enabled) {
+			deltaFrames = enabled;
+			previous.clear();
+		}
+
+		//Frames from here on get a graphic control extension with this delay
+		void setDelay(uint16_t const hundredths) {
+			if (!control)
+				control.emplace();
+			control->setDelay(hundredths);
+		}
+
+		//See encoder::setTransparencyMasking, the last palette entry becomes the transparent index
+		void setTransparencyMasking(bool const enabled) {
+			masking = enabled;
+			lookup.reset();
+			loosePalette.reset();
+			if (masking && !control)
+				control.emplace();
+			if (control)
+				control->setTransparent(masking ? std::optional<uint8_t>(uint8_t(255)) : std::nullopt);
+		}
+
+		//Only matters before the first frame, that is where the palette comes from
+		void setQuantizer(quantizer const mode) {
+			quantization = mode;
+		}
+
+		//Every frame added from here on adds to stats, see encoder::setStats. Time spent in the sink isn't counted.
+		void setStats(encodeStats* const target) {
+			stats = target;
+		}
+
+		//The view is only read during the call, the caller can reuse its buffer right after
+		void add_frame(pixelView const& pixels) {
+			if (finished)
+				throw std::logic_error("Frame added after the trailer was written");
+			if (pixels.width() != width || pixels.height() != height)
+				throw std::invalid_argument("Frame does not cover the screen");
+
+			encodeStats::time elapsed;
+			std::optional<stageClock> total;
+			total.emplace(collectStats && stats ? &elapsed : nullptr);
+			if (collectStats && stats)
+				stats->frames.emplace_back().index = added;
+			added++;
+
+			std::optional<stageClock> timing;
+			if (!GCT) {
+				timing.emplace(statsTime(encodeStats::quantization));
+				GCT.emplace(quantize(pixels, quantization));
+			}
+			if (!started) {
+				timing.emplace(statsTime(encodeStats::framing));
+				start();
 			}
-			//End of pixels, final key
-			out.push_back(currentKey);
-			out.push_back(end_of_info);
 
-			//Biggest key we needed
-			auto const bitsUsed = [](uint16_t const n) -> size_t {
-				std::bitset<14> highest = n;
-				for (size_t i = highest.size() - 1; i > 1; i--) {
-					if (highest.test(i))
-						return i + 1;
-				}
-				return 2;
+			timing.emplace(statsTime(encodeStats::analysis));
+			auto const last = previous.empty() ? pixelView() : pixelView(previous, width, height);
+			auto const area = deltaFrames && !previous.empty() ? dirtyRegion(last, pixels) : region{ 0, 0, width, height };
+			auto descriptor = imageDescriptor(width, height);
+			descriptor.setRegion(area);
+			descriptor.setInterlaced(interlaced);
 
-			}(compressionID);
+			timing.emplace(statsTime(encodeStats::framing));
+			auto writer = appendTo(buffer, (control ? graphicControlExtension::size : 0) + imageDescriptor::size);
+			if (control)
+				control.value().write(writer);
+			descriptor.write(writer);
 
-			lzw_code res;
+			timing.emplace(statsTime(encodeStats::mapping));
+			if (!lookup) {
+				auto const& table = GCT.value().table;
+				auto const usable = std::min(masking ? table.size() - 1 : table.size(), paletteColors);
+				lookup.emplace(colorTable(std::vector<RGBpixel>(table.begin(), table.begin() + ptrdiff_t(usable))), mapping);
+			}
 
-			switch (bitsUsed) {
-			case 2:
-			{
-				res = toBitset<2>(out);
-				break;
+			indices.resize(size_t(area.width) * area.height);
+			lookup.value().map(pixels.sub(area), indices.data());
+			if (masking && !previous.empty())
+				maskUnchanged(last, pixels, area, indices, 255);
+
+			timing.emplace(statsTime(encodeStats::compression));
+			std::optional<lossyTarget> loose;
+			if (lossy != 0) {
+				if (!loosePalette)
+					loosePalette.emplace(GCT.value(), lossy, masking ? std::optional<uint8_t>(255) : std::nullopt);
+				loose = lossyTarget{ pixels.sub(area), &loosePalette.value(), 0, interlaced };
 			}
-			case 3:
-			{
-				res = toBitset<3>(out);
-				break;
+			auto* const counts = collectStats && stats ? &stats->frames.back().lzw : nullptr;
+			if (auto asBytes = compressor.encode(indices, GCT.value().bitsNeeded(), area.width, threads, std::move(compressed), counts,
+				loose ? &loose.value() : nullptr, interlaced); asBytes) {
+				auto& [bytes, size] = asBytes.value();
+				timing.emplace(statsTime(encodeStats::framing));
+				writeImageData(buffer, bytes, size);
+				compressed = std::move(bytes);
 			}
-			case 4:
-			{
-				res = toBitset<4>(out);
-				break;
+			timing.reset();
+			total.reset();
+			flush();
+
+			total.emplace(collectStats && stats ? &elapsed : nullptr);
+			if (deltaFrames || masking) {
+				timing.emplace(statsTime(encodeStats::analysis));
+				pixels.copyTo(previous);
+				timing.reset();
 			}
-			case 5:
-			{
-				res = toBitset<5>(out);
-				break;
+			total.reset();
+
+			if (collectStats && stats) {
+				auto& frame = stats->frames.back();
+				frame.pixels = indices.size();
+				frame.paletteSize = GCT.value().table.size();
+				frame.compressedBytes = compressed.size();
+				for (size_t stage = 0; stage < encodeStats::stages; stage++)
+					stats->times[stage].add(frame.times[stage]);
+				stats->lzw.add(frame.lzw);
+				stats->paletteSize = frame.paletteSize;
+				stats->peakBufferBytes = std::max(stats->peakBufferBytes,
+					buffer.capacity() + indices.capacity() + compressed.capacity() + previous.capacity() * sizeof(RGBpixel));
+				stats->elapsedMs += elapsed.wallMs;
 			}
-			case 6:
-			{
-				res = toBitset<6>(out);
-				break;
+		}
+
+		void add_frame(std::vector<RGBpixel> const& pixels) {
+			if (finished)
+				throw std::logic_error("Frame added after the trailer was written");
+			add_frame(pixelView(pixels, width, height));
+		}
+
+		void finish() {
+			if (finished)
+				return;
+			if (!started)
+				start();
+			buffer.emplace_back(end.trail);
+			flush();
+			finished = true;
+		}
+	};
+
+	auto toStream(std::ostream& os) -> streamEncoder::sink {
+		return [&os](byte const* data, size_t size) {
+			os.write(reinterpret_cast<char const*>(data), std::streamsize(size));
+		};
+	}
+
+	//Also covers file descriptors through fdopen
+	auto toFile(std::FILE* f) -> streamEncoder::sink {
+		return [f](byte const* data, size_t size) {
+			if (std::fwrite(data, 1, size, f) != size)
+				throw std::runtime_error("Short write to file");
+		};
+	}
+
+	//Table driven LZW decoding. Every code above the end code is a shorter code plus one index, and its length and
+	//first index are kept next to it, so a string is written back to front straight into the output without a stack.
+	//The tables have a fixed size, decoding never allocates.
+	class lzwDecoder {
+	private:
+		static constexpr uint16_t maxCode = 4096;
+		static constexpr uint16_t noCode = maxCode;
+
+		std::array<uint16_t, maxCode> prefix{};
+		std::array<uint16_t, maxCode> length{};
+		std::array<uint8_t, maxCode> suffix{};
+		std::array<uint8_t, maxCode> first{};
+
+		//Writes the string of code to out, only the first room indices of it when it doesn't fit
+		auto put(uint16_t code, uint16_t const endCode, byte* const out, size_t const room) const -> size_t {
+			size_t const size = length[code];
+			if (size <= room) {
+				auto* at = out + size - 1;
+				for (; code > endCode; code = prefix[code])
+					*at-- = byte(suffix[code]);
+				*at = byte(code);
+				return size;
 			}
-			case 7:
-			{
-				res = toBitset<7>(out);
-				break;
+			for (auto at = size - 1; code > endCode; code = prefix[code], at--) {
+				if (at < room)
+					out[at] = byte(suffix[code]);
 			}
-			case 8:
-			{
-				res = toBitset<8>(out);
-				break;
+			if (room != 0)
+				out[0] = byte(code);
+			return room;
+		}
+
+	public:
+		//Decodes joined sub-block data into at most count indices and returns how many were written,
+		//fewer than count when the stream ends early. The code width follows the encoder, see encoder::lzw_codes.
+		auto decode(byte const* data, size_t const size, size_t const minCodeSize, byte* const out, size_t const count) -> size_t {
+			if (minCodeSize < 1 || minCodeSize > 11)
+				throw std::invalid_argument("Invalid LZW minimum code size");
+			uint16_t const clearCode = uint16_t(1) << minCodeSize;
+			uint16_t const endCode = clearCode + 1;
+			for (uint16_t code = 0; code < clearCode; code++) {
+				length[code] = 1;
+				first[code] = uint8_t(code);
 			}
-			case 9:
-			{
-				res = toBitset<9>(out);
-				break;
+
+			size_t codeBits = minCodeSize + 1;
+			uint16_t nextCode = endCode + 1;
+			uint16_t previous = noCode;
+			size_t written = 0;
+
+			uint32_t bits = 0;
+			size_t available = 0;
+			size_t at = 0;
+			while (true) {
+				while (available < codeBits && at < size) {
+					bits |= uint32_t(uint8_t(data[at++])) << available;
+					available += 8;
+				}
+				if (available < codeBits)
+					break;
+				auto const code = uint16_t(bits & ((uint32_t(1) << codeBits) - 1));
+				bits >>= codeBits;
+				available -= codeBits;
+
+				if (code == clearCode) {
+					codeBits = minCodeSize + 1;
+					nextCode = endCode + 1;
+					previous = noCode;
+				}
+				else if (code == endCode) {
+					break;
+				}
+				else if (previous == noCode) {
+					if (code > clearCode)
+						throw std::invalid_argument("Corrupt LZW data");
+					written += put(code, endCode, out + written, count - written);
+					previous = code;
+				}
+				else {
+					if (code > nextCode || (code == nextCode && nextCode == maxCode))
+						throw std::invalid_argument("Corrupt LZW data");
+					//A code one past the table is the previous string plus its own first index
+					if (nextCode < maxCode) {
+						prefix[nextCode] = previous;
+						suffix[nextCode] = code < nextCode ? first[code] : first[previous];
+						first[nextCode] = first[previous];
+						length[nextCode] = uint16_t(length[previous] + 1);
+						nextCode++;
+					}
+					written += put(code, endCode, out + written, count - written);
+					previous = code;
+				}
+
+				if (nextCode == (uint32_t(1) << codeBits) && codeBits < 12)
+					codeBits++;
 			}
-			case 10:
-			{
-				res = toBitset<10>(out);
-				break;
+			return written;
+		}
+	};
+
+	//Reads a GIF straight from memory, which the caller keeps alive while decoding.
+	//next() steps from image to image, decode() writes the indices of the current one to a caller buffer and composite()
+	//draws it onto a canvas like a viewer would, after disposing of the previous frame the way that one asked for.
+	//Buffers are kept between images, so decoding an animation only allocates while they grow.
+	class decoder {
+	public:
+		//An image with what its graphic control extension said about it
+		struct frame {
+			region area;
+			uint16_t delay = 0;
+			disposal dispose = disposal::unspecified;
+			std::optional<uint8_t> transparent;
+			bool interlaced = false;
+			bool localColorTable = false;
+			bool graphicControl = false;
+		};
+
+	private:
+		byteReader in;
+		uint16_t width = 0;
+		uint16_t height = 0;
+		uint8_t backgroundIndex = 0;
+		std::vector<RGBpixel> global;
+		std::vector<RGBpixel> local;
+		std::optional<uint16_t> loopCount;
+
+		//Graphic control extension seen since the last image
+		frame pending;
+
+		//The image next() stopped at. Its data is left in the file, from the minimum code size to the block terminator,
+		//and the sub-blocks are only joined into one run of codes once something decodes it.
+		std::optional<frame> current;
+		byte const* imageBlocks = nullptr;
+		size_t imageSize = 0;
+		std::vector<byte> codes;
+		lzwDecoder lzw;
+
+		//Canvas state between composite() calls
+		bool painted = false;
+		std::optional<frame> drawn;
+		std::vector<RGBpixel> saved;
+		std::vector<byte> indices;
+		std::vector<byte> rows;
+
+		void readTable(std::vector<RGBpixel>& table, size_t const colors) {
+			auto const* const data = in.take(colors * 3);
+			table.resize(colors);
+			for (size_t i = 0; i < colors; i++) {
+				table[i] = RGBpixel{ uint8_t(data[i * 3]), uint8_t(data[i * 3 + 1]), uint8_t(data[i * 3 + 2]) };
 			}
-			case 11:
-			{
-				res = toBitset<11>(out);
-				break;
+		}
+
+		//Calls f with every sub-block up to the terminator
+		template<typename F>
+		void forEachBlock(F&& f) {
+			for (auto size = in.get(); size != 0; size = in.get()) {
+				f(in.take(size), size_t(size));
 			}
-			case 12:
-			{
-				res = toBitset<12>(out);
-				break;
+		}
+
+		void readExtension() {
+			auto const label = in.get();
+			if (label == 0xf9) {
+				auto const size = in.get();
+				auto const* const block = in.take(size);
+				if (size >= 4) {
+					auto const packed = uint8_t(block[0]);
+					auto const method = (packed >> 2) & 7;
+					pending.dispose = method <= 3 ? disposal(method) : disposal::unspecified;
+					pending.delay = uint16_t(uint8_t(block[1]) | (uint8_t(block[2]) << 8));
+					pending.transparent = (packed & 1) ? std::optional<uint8_t>(uint8_t(block[3])) : std::nullopt;
+					pending.graphicControl = true;
+				}
+				forEachBlock([](byte const*, size_t) {});
 			}
-			case 13:
-			{
-				res = toBitset<13>(out);
-				break;
+			else if (label == 0xff) {
+				auto const size = in.get();
+				auto const* const identifier = in.take(size);
+				auto const looping = size == 11 && std::memcmp(identifier, "NETSCAPE2.0", 11) == 0;
+				forEachBlock([&](byte const* block, size_t const blockSize) {
+					if (looping && blockSize >= 3 && uint8_t(block[0]) == 1)
+						loopCount = uint16_t(uint8_t(block[1]) | (uint8_t(block[2]) << 8));
+					});
 			}
-			case 14:
-			{
-				res = toBitset<14>(out);
-				break;
+			else {
+				//Comments, plain text and applications we don't know
+				forEachBlock([](byte const*, size_t) {});
+			}
+		}
+
+		auto background() const -> RGBpixel {
+			return backgroundIndex < global.size() ? global[backgroundIndex] : RGBpixel{};
+		}
+
+		//The part of an image that lies on the screen
+		auto clipped(region const& area) const -> region {
+			return intersection(area, region{ 0, 0, width, height });
+		}
+
+		void dispose(frame const& last, RGBpixel* const canvas) {
+			auto const area = clipped(last.area);
+			if (last.dispose == disposal::background) {
+				for (size_t y = area.top; y < size_t(area.top) + area.height; y++) {
+					std::fill_n(canvas + y * width + area.left, area.width, background());
+				}
 			}
+			else if (last.dispose == disposal::previous) {
+				for (size_t y = 0; y < area.height; y++) {
+					std::copy_n(saved.data() + y * area.width, area.width, canvas + (area.top + y) * width + area.left);
+				}
 			}
+		}
 
-			return res;
+	public:
+		decoder(byte const* data, size_t const size) : in(data, size) {
+			auto const* const signature = in.take(6);
+			if (std::memcmp(signature, "GIF", 3) != 0)
+				throw std::invalid_argument("Not a GIF");
+			width = in.get16();
+			height = in.get16();
+			auto const packed = in.get();
+			backgroundIndex = in.get();
+			in.get(); //Pixel aspect ratio
+			if (packed & 0x80)
+				readTable(global, size_t(2) << (packed & 7));
+		}
+
+		explicit decoder(std::vector<byte> const& file) : decoder(file.data(), file.size()) {}
+
+		//The decoder keeps pointing into the data, a temporary would be gone before the first frame
+		explicit decoder(std::vector<byte>&& file) = delete;
+
+		auto dimensions() const -> std::pair<uint16_t, uint16_t> {
+			return { width, height };
 		}
 
-		auto encode(std::vector<byte> const& in, size_t const colorTableBits) -> std::optional<std::pair<std::vector<byte>, size_t>> {
-			auto enc = lzw_encode(in, colorTableBits);
-			auto packed = std::visit([](auto const& v) -> std::optional<std::pair<std::vector<byte>, size_t>> {
-				return pack(v);
-				}, enc);
-			return packed;
+		//Loop count of the NETSCAPE extension, 0 for forever. Only known once next() went past it.
+		auto loops() const -> std::optional<uint16_t> {
+			return loopCount;
 		}
 
-		auto write() -> std::optional<std::vector<byte>> {
-			std::vector<byte> out;
-			std::copy(signature.signature.begin(), signature.signature.end(), std::back_inserter(out));
+		//The color table the current image uses
+		auto palette() const -> std::vector<RGBpixel> const& {
+			return current && current.value().localColorTable ? local : global;
+		}
+
+		//Empty when the file has none
+		auto globalPalette() const -> std::vector<RGBpixel> const& {
+			return global;
+		}
+
+		auto backgroundColorIndex() const -> uint8_t {
+			return backgroundIndex;
+		}
 
-			auto it = screen.write();
-			std::copy(it.begin(), it.end(), std::back_inserter(out));
+		//The image data of the current image as it is in the file, minimum code size and block terminator included
+		auto imageData() const -> std::pair<byte const*, size_t> {
+			return { imageBlocks, imageSize };
+		}
 
-			colorTable* activeTable = nullptr;
+		//Bits per index the current image's codes start from
+		auto minimumCodeSize() const -> size_t {
+			return imageSize != 0 ? size_t(uint8_t(imageBlocks[0])) : 0;
+		}
 
-			if (GCT) {
-				activeTable = &GCT.value();
-				for (auto const& p : activeTable->table) {
-					auto bytes = p.write();
-					std::copy(bytes.begin(), bytes.end(), std::back_inserter(out));
+		//Reads up to and including the next image, nullopt once the trailer or the end of the data is reached
+		auto next() -> std::optional<frame> {
+			current.reset();
+			pending = frame();
+			while (in.remaining() != 0) {
+				auto const label = in.get();
+				if (label == 0x3b)
+					return std::nullopt;
+				if (label == 0x21) {
+					readExtension();
+					continue;
 				}
+				if (label != 0x2c)
+					throw std::invalid_argument("Unknown block in GIF data");
+
+				auto image = pending;
+				image.area.left = in.get16();
+				image.area.top = in.get16();
+				image.area.width = in.get16();
+				image.area.height = in.get16();
+				auto const packed = in.get();
+				image.interlaced = (packed & 0x40) != 0;
+				image.localColorTable = (packed & 0x80) != 0;
+				if (image.localColorTable)
+					readTable(local, size_t(2) << (packed & 7));
+
+				imageBlocks = in.at();
+				in.get(); //Minimum code size
+				forEachBlock([](byte const*, size_t) {});
+				imageSize = size_t(in.at() - imageBlocks);
+				current = image;
+				return current;
+			}
+			return std::nullopt;
+		}
+
+		//Writes the indices of the current image to out, area.width * area.height of them with rows top to bottom.
+		//Pixels missing from a short stream are the transparent index when there is one, otherwise 0.
+		void decode(byte* const out) {
+			if (!current)
+				throw std::logic_error("No image to decode, next() has to find one first");
+			auto const& image = current.value();
+			auto const count = size_t(image.area.width) * image.area.height;
+
+			codes.clear();
+			for (size_t at = 1; at < imageSize && imageBlocks[at] != byte(0); at += size_t(imageBlocks[at]) + 1) {
+				codes.insert(codes.end(), imageBlocks + at + 1, imageBlocks + at + 1 + size_t(imageBlocks[at]));
+			}
+
+			if (image.interlaced)
+				rows.resize(count);
+			auto* const target = image.interlaced ? rows.data() : out;
+			auto const written = lzw.decode(codes.data(), codes.size(), minimumCodeSize(), target, count);
+			std::fill(target + written, target + count, byte(image.transparent.value_or(0)));
+			if (!image.interlaced)
+				return;
+
+			size_t const w = image.area.width;
+			for (size_t n = 0; n < image.area.height; n++) {
+				std::copy_n(rows.data() + n * w, w, out + interlacedRow(n, image.area.height) * w);
 			}
-			if (loop) {
-				auto bytes = loop.value().write();
-				std::copy(bytes.begin(), bytes.end(), std::back_inserter(out));
+		}
+
+		//Draws the current image onto canvas, width * height pixels the caller keeps between calls.
+		//The first call fills canvas with the background color, since that is what the screen starts out as.
+		//Transparent pixels leave what is below them, and parts outside the screen or outside crop are cut off.
+		//A cropped image is also only disposed of inside crop.
+		void composite(RGBpixel* const canvas, std::optional<region> const& crop = std::nullopt) {
+			if (!current)
+				throw std::logic_error("No image to composite, next() has to find one first");
+			auto const& image = current.value();
+
+			if (!painted) {
+				std::fill_n(canvas, size_t(width) * height, background());
+				painted = true;
 			}
+			if (drawn)
+				dispose(drawn.value(), canvas);
 
-			for (auto& [desc, localTable, pixels] : descriptors) {
-				{
-					auto bytes = desc.write();
-					std::copy(bytes.begin(), bytes.end(), std::back_inserter(out));
+			indices.resize(size_t(image.area.width) * image.area.height);
+			decode(indices.data());
+
+			auto const area = crop ? intersection(clipped(image.area), crop.value()) : clipped(image.area);
+			if (image.dispose == disposal::previous) {
+				saved.resize(size_t(area.width) * area.height);
+				for (size_t y = 0; y < area.height; y++) {
+					std::copy_n(canvas + (area.top + y) * width + area.left, area.width, saved.data() + y * area.width);
 				}
+			}
 
-				if (localTable) {
-					activeTable = &localTable.value();
-					for (auto const& p : activeTable->table) {
-						auto bytes = p.write();
-						std::copy(bytes.begin(), bytes.end(), std::back_inserter(out));
+			//Indices past the end of the table come out black
+			std::array<RGBpixel, 256> colors{};
+			auto const& table = palette();
+			std::copy_n(table.begin(), std::min(table.size(), colors.size()), colors.begin());
+
+			for (size_t y = 0; y < area.height; y++) {
+				auto const* const from = indices.data() + (area.top - image.area.top + y) * image.area.width + (area.left - image.area.left);
+				auto* const to = canvas + (area.top + y) * width + area.left;
+				if (image.transparent) {
+					auto const skip = image.transparent.value();
+					for (size_t x = 0; x < area.width; x++) {
+						if (uint8_t(from[x]) != skip)
+							to[x] = colors[uint8_t(from[x])];
+					}
+				}
+				else {
+					for (size_t x = 0; x < area.width; x++) {
+						to[x] = colors[uint8_t(from[x])];
 					}
 				}
+			}
+			drawn = image;
+			drawn.value().area = area;
+		}
+	};
+
+	//Rewrites an existing GIF with a different loop count, other delays, frames left out or frames cropped.
+	//Frames whose pixels stay the same keep their compressed data byte for byte. Only when an edit changes what is
+	//on screen are frames decoded, and only frames that have to draw something new are encoded again.
+	//Comments and unknown extensions are left out, and like the decoder it reads the caller's data in place.
+	class optimizer {
+	private:
+		struct source {
+			decoder::frame info;
+			std::vector<RGBpixel> localTable;
+			byte const* blocks = nullptr;
+			size_t blocksSize = 0;
+			bool dropped = false;
+			std::optional<region> crop;
+		};
+
+		byte const* data = nullptr;
+		size_t size = 0;
+		uint16_t width = 0;
+		uint16_t height = 0;
+		uint8_t backgroundIndex = 0;
+		std::vector<RGBpixel> global;
+		std::optional<uint16_t> loops;
+		std::vector<source> frames;
+		size_t copied = 0;
+		size_t decoded = 0;
+
+		//Scratch for the frames that are encoded again
+		encoder compressor;
+		std::vector<RGBpixel> canvas;
+		std::vector<byte> indices;
+		std::vector<byte> cropped;
+
+		auto at(size_t const frame) -> source& {
+			if (frame >= frames.size())
+				throw std::out_of_range("No such frame");
+			return frames[frame];
+		}
+
+		//Tables in a file hold a power of two of at least 2 entries
+		static auto tableBits(size_t const colors) -> size_t {
+			size_t bits = 1;
+			while ((size_t(1) << bits) < colors)
+				bits++;
+			return bits;
+		}
+
+		//Tables in a file hold a power of two of entries
+		static auto padded(std::vector<RGBpixel> table) -> std::vector<RGBpixel> {
+			table.resize(size_t(1) << tableBits(table.size()));
+			return table;
+		}
+
+		//A frame that paints every pixel of the screen, whatever came before it is hidden
+		auto repaints(source const& image) const -> bool {
+			auto const area = intersection(image.info.area, region{ 0, 0, width, height });
+			return !image.crop && !image.info.transparent && area.width == width && area.height == height;
+		}
+
+		//Brings canvas up to what the animation shows just before frame, shown is how far it got so far.
+		//Only frames from the last one that repaints the whole screen get decoded, the others are skipped over.
+		void catchUp(decoder& dec, size_t& shown, size_t const frame) {
+			auto start = shown;
+			for (auto i = frame; i > shown; i--) {
+				if (repaints(frames[i - 1])) {
+					start = i - 1;
+					break;
+				}
+			}
+			for (; shown < start; shown++)
+				dec.next();
+			for (; shown < frame; shown++)
+				show(dec, shown);
+		}
 
-				//we need a table after all
-				if (activeTable == nullptr)
+		void show(decoder& dec, size_t const frame) {
+			dec.next();
+			dec.composite(canvas.data(), frames[frame].crop);
+			decoded++;
+		}
+
+		//Encodes the canvas pixels in area with table when it holds all of their colors. Otherwise table is
+		//replaced by a quantized one for the frame's own use.
+		auto redraw(region const& area, std::vector<RGBpixel>& table, bool& own) -> std::pair<std::vector<byte>, size_t> {
+			auto const pixels = pixelView(canvas, width, height).sub(area);
+			auto mapped = mapPixels(pixels, colorTable(table));
+			if (mappingError(pixels, mapped, colorTable(table)) != 0) {
+				table = padded(quantize(pixels, quantizer::medianCut));
+				own = true;
+				mapped = mapPixels(pixels, colorTable(table));
+			}
+			return compressor.encode(mapped, std::max(size_t(2), tableBits(table.size())), area.width).value();
+		}
+
+	public:
+		optimizer(byte const* file, size_t const fileSize) : data(file), size(fileSize) {
+			decoder dec(file, fileSize);
+			std::tie(width, height) = dec.dimensions();
+			backgroundIndex = dec.backgroundColorIndex();
+			global = dec.globalPalette();
+			while (auto const frame = dec.next()) {
+				source image;
+				image.info = frame.value();
+				if (image.info.localColorTable)
+					image.localTable = dec.palette();
+				std::tie(image.blocks, image.blocksSize) = dec.imageData();
+				frames.push_back(std::move(image));
+			}
+			loops = dec.loops();
+		}
+
+		explicit optimizer(std::vector<byte> const& file) : optimizer(file.data(), file.size()) {}
+
+		//Reads the file in place, a temporary would be gone before write()
+		explicit optimizer(std::vector<byte>&& file) = delete;
+
+		auto frameCount() const -> size_t {
+			return frames.size();
+		}
+
+		auto frameInfo(size_t const frame) const -> decoder::frame const& {
+			if (frame >= frames.size())
+				throw std::out_of_range("No such frame");
+			return frames[frame].info;
+		}
+
+		//nullopt plays the animation once, 0 loops forever
+		void setLoops(std::optional<uint16_t> const count) {
+			loops = count;
+		}
+
+		void setDelay(size_t const frame, uint16_t const hundredths) {
+			auto& image = at(frame);
+			image.info.delay = hundredths;
+			image.info.graphicControl = true;
+		}
+
+		//The frame isn't shown, its delay goes to the frame shown before it. Frames after it that relied on
+		//what it drew are encoded again so every frame that is left looks like it did.
+		void dropFrame(size_t const frame) {
+			at(frame).dropped = true;
+		}
+
+		//Only the part of the frame inside area is drawn, from then on the animation shows the frame that way
+		void cropFrame(size_t const frame, region const& area) {
+			auto& image = at(frame);
+			if (intersection(image.info.area, area).width == 0)
+				throw std::invalid_argument("Crop leaves nothing of the frame");
+			image.crop = area;
+		}
+
+		//Frames the last write() copied with their image data unchanged
+		auto copiedFrames() const -> size_t {
+			return copied;
+		}
+
+		//Frames the last write() had to decode, either to draw the screen or to crop them
+		auto decodedFrames() const -> size_t {
+			return decoded;
+		}
+
+		template<typename Buffer>
+		auto writeTo(Buffer& out) -> size_t {
+			//Delays of the frames that are shown, a dropped frame's time goes to the one before it
+			std::vector<uint32_t> delays;
+			uint32_t carried = 0;
+			for (auto const& image : frames) {
+				if (image.dropped) {
+					if (delays.empty())
+						carried += image.info.delay;
+					else
+						delays.back() += image.info.delay;
 					continue;
+				}
+				delays.push_back(image.info.delay + carried);
+				carried = 0;
+			}
+			if (delays.empty())
+				throw std::invalid_argument("No frames");
 
-				auto const mapped = mapPixels(pixels, *activeTable);
-				auto const asBytes = encode(mapped, activeTable->bitsNeeded());
+			out.clear();
+			auto screen = screenDescriptor(width, height, !global.empty());
+			auto const globalTable = padded(global);
+			if (!global.empty())
+				screen.setGlobalColor(tableBits(global.size()));
+			screen.setBackground(backgroundIndex);
+			auto writer = appendTo(out, header::size + screenDescriptor::size + (global.empty() ? 0 : globalTable.size() * 3) +
+				(loops ? applicationExtensionLoop::size : 0));
+			header().write(writer);
+			screen.write(writer);
+			if (!global.empty())
+				colorTable(globalTable).write(writer);
+			if (loops)
+				applicationExtensionLoop(loops.value()).write(writer);
 
-				if (!asBytes.has_value())
+			//The screen is only drawn for frames that are encoded again after a dropped frame, and frames that are only
+			//cropped are read on their own. Without edits to the pixels nothing is decoded at all.
+			std::optional<decoder> screenDecoder;
+			std::optional<decoder> frameDecoder;
+			size_t shown = 0;
+			size_t read = 0;
+
+			//Where the output may differ from what the edited animation shows at this point
+			auto const screenArea = region{ 0, 0, width, height };
+			region diverged;
+			copied = 0;
+			decoded = 0;
+			for (size_t i = 0, k = 0; i < frames.size(); i++) {
+				auto const& image = frames[i];
+				auto const& info = image.info;
+				auto const area = image.crop ? intersection(info.area, image.crop.value()) : info.area;
+				if (!image.dropped && repaints(image))
+					diverged = region{};
+				if (!image.dropped && diverged.width != 0) {
+					if (!screenDecoder) {
+						screenDecoder.emplace(data, size);
+						canvas.resize(size_t(width) * height);
+					}
+					catchUp(screenDecoder.value(), shown, i);
+					show(screenDecoder.value(), i);
+					shown = i + 1;
+				}
+				if (image.dropped) {
+					diverged = boundingBox(diverged, intersection(area, screenArea));
 					continue;
+				}
 
-				auto const [bytes, size] = asBytes.value();
-				out.emplace_back(byte(size - 1));
+				auto control = graphicControlExtension(uint16_t(std::min(delays[k++], uint32_t(UINT16_MAX))), info.dispose);
+				control.setTransparent(info.transparent);
+				auto descriptor = imageDescriptor(area.width, area.height);
+				descriptor.setRegion(area);
+				auto const palette = padded(info.localColorTable ? image.localTable : global);
+
+				if (diverged.width == 0 && !image.crop) {
+					//Same pixels on the same screen, the image data goes out as it came in
+					descriptor.setInterlaced(info.interlaced);
+					if (info.localColorTable)
+						descriptor.setLocalColor(tableBits(palette.size()));
+					auto frameWriter = appendTo(out, (info.graphicControl || control.getDelay() != 0 ? graphicControlExtension::size : 0) + imageDescriptor::size +
+						(info.localColorTable ? palette.size() * 3 : 0) + image.blocksSize);
+					if (info.graphicControl || control.getDelay() != 0)
+						control.write(frameWriter);
+					descriptor.write(frameWriter);
+					if (info.localColorTable)
+						colorTable(palette).write(frameWriter);
+					frameWriter.put(image.blocks, image.blocksSize);
+					copied++;
+					continue;
+				}
 
-				auto bytesLeft = bytes.size();
-				auto amountOfBlocks = bytesLeft / 0xff;
-				for (size_t block = 0; block < amountOfBlocks; block++) {
-					out.emplace_back(byte(0xff)); //Block size
-					std::copy(bytes.begin() + (block * 0xff), bytes.begin() + ((block + 1) * 0xff), std::back_inserter(out));
+				auto table = palette;
+				auto own = info.localColorTable;
+				std::pair<std::vector<byte>, size_t> compressed;
+				if (diverged.width == 0) {
+					//Only cropped, the indices that are left keep their table and transparency
+					if (!frameDecoder)
+						frameDecoder.emplace(data, size);
+					auto& decoding = frameDecoder.value();
+					for (; read <= i; read++)
+						decoding.next();
+					indices.resize(size_t(info.area.width) * info.area.height);
+					decoding.decode(indices.data());
+					decoded++;
+					cropped.resize(size_t(area.width) * area.height);
+					for (size_t y = 0; y < area.height; y++) {
+						std::copy_n(indices.data() + (area.top - info.area.top + y) * info.area.width + (area.left - info.area.left),
+							area.width, cropped.data() + y * area.width);
+					}
+					compressed = compressor.encode(cropped, decoding.minimumCodeSize(), area.width).value();
+				}
+				else {
+					//Covers everything that differs with what the edited animation shows, opaque and kept on screen
+					auto const shownArea = intersection(area, screenArea);
+					descriptor.setRegion(boundingBox(shownArea, diverged));
+					compressed = redraw(descriptor.area(), table, own);
+					control = graphicControlExtension(control.getDelay(), disposal::keep);
+					diverged = info.dispose == disposal::background || info.dispose == disposal::previous ? shownArea : region{};
 				}
-				bytesLeft -= amountOfBlocks * 0xff;
-				auto trailingBytes = bytesLeft % 0xff;
-				out.emplace_back(byte(trailingBytes));
 
-				std::copy(bytes.end() - trailingBytes, bytes.end(), std::back_inserter(out));
-				out.emplace_back(byte(0)); //END of image block
+				if (own)
+					descriptor.setLocalColor(tableBits(table.size()));
+				auto frameWriter = appendTo(out, graphicControlExtension::size + imageDescriptor::size + (own ? table.size() * 3 : 0) +
+					imageDataSize(compressed.first.size()));
+				control.write(frameWriter);
+				descriptor.write(frameWriter);
+				if (own)
+					colorTable(table).write(frameWriter);
+				writeImageData(frameWriter, compressed.first, compressed.second);
 			}
-			out.emplace_back(end.trail);
+			out.push_back(trailer().trail);
+			return out.size();
+		}
+
+		auto write() -> std::vector<byte> {
+			std::vector<byte> out;
+			writeTo(out);
 			return out;
 		}
 	};
@@ -598,7 +4155,7 @@ namespace gif {
 	template<std::size_t n>
 	auto pack(std::vector<std::bitset<n>> const in) -> std::pair<std::vector<byte>, size_t> {
 		if constexpr (n < 2 || n > 14) {
-			throw std::exception("Bitset too small or large, error somewhere else?");
+			throw std::logic_error("Bitset too small or large, error somewhere else?");
 		}
 
 		auto totalbits = in.size() * n;